@@ -82,6 +82,7 @@ int ae_set_sys_info(RTX_SYS_INFO *sys_info)
     }
 
     sys_info->mem_algo      = BUDDY;
+    sys_info->mem_cache     = NULL;     // mem_alloc goes straight to the buddy allocator
 #ifndef ECE350_P4
     sys_info->sched         = DEFAULT;
 #else    
@@ -37,6 +37,8 @@
 
 
 #include "timer.h"
+#include "k_inc.h"
+#include "k_rtx.h"
 
 #define BIT(X) ( 1UL << (X) )
 
@@ -134,6 +136,7 @@ void TIMER0_IRQHandler(void)
     LPC_TIM0->IR = BIT(0);  
     
     g_timer_count++ ;
+    k_tsk_tick();           // expire timeouts, pass on keystrokes
 }
 
 
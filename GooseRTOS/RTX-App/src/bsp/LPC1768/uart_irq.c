@@ -41,11 +41,17 @@
 
 uint8_t g_buffer[]= "You Typed a Q\n\r";
 static uint8_t *gp_buffer = g_buffer;       // TX IRQ read/write this var      
-uint8_t g_send_char = 0;                    // main() read/write this flag
-uint8_t g_char_in;                          // main() read this var
 uint8_t g_tx_irq = 0;                       // initial TX irq is off
 uint8_t g_switch_flag = FALSE;
 
+/* single producer, single consumer ring from the RX ISR to uart_rx_get.
+   The ISR only moves the tail and the consumer only the head, so neither
+   side locks. Both are free running, tail - head is the fill level. */
+static volatile uint8_t  g_rx_ring[UART_RX_RING_SIZE];
+static volatile uint32_t g_rx_head;         // next char to take, uart_rx_get writes it
+static volatile uint32_t g_rx_tail;         // next free slot, UART0_IRQHandler writes it
+uint32_t g_uart_rx_drops;                   // chars that found the ring full
+
 /**************************************************************************//**
  * @brief   initializes the n_uart interrupts
  * @note    it only supports UART0. It can be easily extended to support UART1 IRQ.
@@ -140,10 +146,11 @@ int uart_irq_init(int n_uart) {
            see table 278 on pg305 in LPC17xx_UM
     -----------------------------------------------------
         enable Rx and Tx FIFOs, clear Rx and Tx FIFOs
-    Trigger level 0 (1 char per interrupt)
+    Trigger level 2 (8 chars per interrupt), the character timeout
+    interrupt delivers the rest, the handler empties the FIFO each time
     */
     
-    pUart->FCR = 0x07;
+    pUart->FCR = 0x87;
 
     /* Step 5 was done between step 2 and step 4 a few lines above */
 
@@ -180,6 +187,28 @@ int uart_irq_init(int n_uart) {
     return 0;
 }
 
+/**
+ * @brief   take up to max received chars out of the RX ring
+ * @return  number of chars copied to buf
+ * @note    the only consumer is k_mbx_uart_rx, it runs in the TIMER0 IRQ
+ *          which has the priority of this one and never preempts it
+ */
+uint32_t uart_rx_get(uint8_t *buf, uint32_t max)
+{
+    uint32_t head = g_rx_head;
+    uint32_t n = g_rx_tail - head;
+    uint32_t i;
+
+    if (n > max) {
+        n = max;
+    }
+    for (i = 0; i < n; i++) {
+        buf[i] = g_rx_ring[(head + i) % UART_RX_RING_SIZE];
+    }
+    g_rx_head = head + n;       // hands the slots back to the ISR
+    return n;
+}
+
 /**
  * @brief: CMSIS ISR for UART0 IRQ Handler
  */
@@ -197,21 +226,25 @@ void UART0_IRQHandler(void)
     IIR_IntId = (pUart->IIR) >> 1 ; /* skip pending bit in IIR */ 
     if (IIR_IntId & IIR_RDA) { /* Receive Data Avaialbe */
         
-        /* Read UART. Reading RBR will clear the interrupt */
-        int char_in = pUart->RBR;
-#ifdef DEBUG_0
-        printf("Reading a char = %c \r\n", char_in);
-#endif /* DEBUG_0 */ 
-        if (g_send_char == 0 && !g_tx_irq) {
-            g_char_in = char_in;
+        uint8_t char_in = 0;
+
+        /* Read UART until the FIFO is empty. Reading RBR will clear the interrupt.
+           The chars go to the RX ring, k_mbx_uart_rx passes them on as KEY_IN */
+        while (pUart->LSR & LSR_RDR) {
+            char_in = pUart->RBR;
 #ifdef DEBUG_0
-            printf("char %c gets processed\r\n", g_char_in);
+            printf("Reading a char = %c \r\n", char_in);
 #endif /* DEBUG_0 */ 
-            g_send_char = 1;
+            if (g_rx_tail - g_rx_head < UART_RX_RING_SIZE) {
+                g_rx_ring[g_rx_tail % UART_RX_RING_SIZE] = char_in;
+                g_rx_tail++;    // publishes the char, after it is stored
+            } else {
+                g_uart_rx_drops++;
+            }
         }
 #ifdef ECE350_P3       
         /* setting the g_continue_flag */
-        if ( g_char_in == 's' ) {
+        if ( char_in == 's' ) {
             g_switch_flag = 1; 
         } else {
             g_switch_flag = 0;
@@ -70,15 +70,39 @@ void SVC_Handler(void)
     U32 *args = (U32 *) __get_PSP();    // read PSP to get stacked args
     
     svc_number = ((S8 *) args[6])[-2];  // Memory[(Stacked PC) - 2]
+#ifdef MEM_TRACE
+    g_mem_trace_site = args[6];         // the caller's return address, for allocator events
+#endif
     switch(svc_number) {
         case SVC_RTX_INIT:
             ret = k_rtx_init((RTX_SYS_INFO*) args[0], (TASK_INIT *) args[1], (int) args[2]);
             break;
         case SVC_MEM_ALLOC:
-            ret = (U32) k_mpool_alloc(MPID_IRAM1, (size_t) args[0]);
+            ret = (U32) k_mem_alloc((size_t) args[0]);
             break;
         case SVC_MEM_DEALLOC:
-            ret = k_mpool_dealloc(MPID_IRAM1, (void *)args[0]);
+            ret = k_mem_dealloc((void *)args[0]);
+            break;
+        case SVC_MEM_REALLOC:
+            ret = (U32) k_mem_realloc((void *)args[0], (size_t) args[1]);
+            break;
+        case SVC_MEM_ALLOC_ALIGNED:
+            ret = (U32) k_mem_alloc_aligned((size_t) args[0], (size_t) args[1]);
+            break;
+        case SVC_HMEM_ALLOC:
+            ret = k_hmem_alloc((size_t) args[0]);
+            break;
+        case SVC_HMEM_FREE:
+            ret = k_hmem_free((hmem_t) args[0]);
+            break;
+        case SVC_HMEM_LOCK:
+            ret = (U32) k_hmem_lock((hmem_t) args[0]);
+            break;
+        case SVC_HMEM_UNLOCK:
+            ret = k_hmem_unlock((hmem_t) args[0]);
+            break;
+        case SVC_HMEM_COMPACT:
+            ret = k_hmem_compact();
             break;
         case SVC_MEM_DUMP:
             ret = k_mpool_dump(MPID_IRAM1);
@@ -88,6 +112,7 @@ void SVC_Handler(void)
             break;
         case SVC_TSK_EXIT:
             k_tsk_exit();
+            args = &ret;    // K_SHARED_STACK returns here, the user stack is already freed
             break;
         case SVC_TSK_YIELD:
             ret = k_tsk_yield();
@@ -125,6 +150,57 @@ void SVC_Handler(void)
         case SVC_MBX_GET:
             ret = k_mbx_get((task_t) args[0]);
             break;
+        case SVC_MBX_SEND_ZC:
+            ret = k_send_msg_zc((task_t) args[0], (void *) args[1]);
+            break;
+        case SVC_MBX_RECV_ZC:
+            ret = k_recv_msg_zc((void **) args[0]);
+            break;
+        case SVC_MBX_RECV_TIMEOUT:
+            ret = k_recv_msg_timeout((void *) args[0], (size_t) args[1], args[2]);
+            break;
+        case SVC_MBX_SEND_TIMEOUT:
+            ret = k_send_msg_timeout((task_t) args[0], (const void *) args[1], args[2]);
+            break;
+        case SVC_MBX_RECV_BATCH:
+            ret = k_recv_msg_batch((void *) args[0], (size_t) args[1], (size_t) args[2]);
+            break;
+        case SVC_MBX_SEND_BATCH:
+            ret = k_send_msg_batch((task_t) args[0], (const void *) args[1], (size_t) args[2]);
+            break;
+        case SVC_TOPIC_OPEN:
+            ret = k_topic_open((const char *) args[0]);
+            break;
+        case SVC_TOPIC_SUBSCRIBE:
+            ret = k_topic_subscribe((topic_t) args[0]);
+            break;
+        case SVC_TOPIC_UNSUBSCRIBE:
+            ret = k_topic_unsubscribe((topic_t) args[0]);
+            break;
+        case SVC_TOPIC_PUBLISH:
+            ret = k_topic_publish((topic_t) args[0], (const void *) args[1]);
+            break;
+        case SVC_MBX_SEND_PRIO:
+            ret = k_send_msg_prio((task_t) args[0], (const void *) args[1], (U8) args[2]);
+            break;
+        case SVC_EV_ADD:
+            ret = k_ev_add((U8) args[0], args[1]);
+            break;
+        case SVC_EV_DEL:
+            ret = k_ev_del((int) args[0]);
+            break;
+        case SVC_EV_SIGNAL:
+            ret = k_ev_signal((task_t) args[0], args[1]);
+            break;
+        case SVC_EV_WAIT:
+            ret = k_wait_any(args[0]);
+            break;
+        case SVC_MBX_RECV_TYPE:
+            ret = k_recv_msg_type((void *) args[0], (size_t) args[1], args[2]);
+            break;
+        case SVC_MBX_STATS:
+            ret = k_mbx_stats((task_t) args[0], (MBX_STATS *) args[1]);
+            break;
         case SVC_RT_TSK_SET:
             ret = k_rt_tsk_set((TIMEVAL*) args[0]);
             break;
@@ -134,6 +210,29 @@ void SVC_Handler(void)
         case SVC_RT_TSK_GET:
             ret = k_rt_tsk_get((task_t) args[0], (TIMEVAL *) args[1]);
             break;
+        case SVC_MEM_ARENA:
+            ret = k_mem_arena_create((size_t) args[0]);
+            break;
+        case SVC_MEM_STATS:
+            ret = k_mpool_stats((mpool_t) args[0], (MPOOL_STATS *) args[1]);
+            break;
+        case SVC_MPOOL_CREATE:
+            ret = k_mpool_user_create((int) args[0], (size_t) args[1]);
+            break;
+        case SVC_MPOOL_ALLOC:
+            ret = (U32) k_mpool_user_alloc((mpool_t) args[0], (size_t) args[1]);
+            break;
+        case SVC_MPOOL_DEALLOC:
+            ret = k_mpool_user_free((mpool_t) args[0], (void *) args[1]);
+            break;
+        case SVC_TSK_GET_STACK:
+            ret = k_tsk_get_stack((task_t) args[0], (RTX_STACK_INFO *) args[1]);
+            break;
+#ifdef MEM_TRACE
+        case SVC_MEM_TRACE_DUMP:
+            ret = k_mem_trace_dump();
+            break;
+#endif
 #ifdef ECE350_P1
         // The following are only for P1 memory testing purpose
         // Future deliverables do not provide the following sys calls to tasks
@@ -151,9 +250,87 @@ void SVC_Handler(void)
             ret = (U32) RTX_ERR;
     }
     
+    if (g_isr_refill) {
+        k_mem_isr_refill();     // top up what interrupt handlers took
+    }
     args[0] = ret;      // return value saved onto the stacked R0
 }
 
+#define FAULT_STACK_SIZE    0x200       // printf from the fault report, the faulting stack may be in a guard
+
+static U32 g_fault_stack[FAULT_STACK_SIZE >> 2] __attribute__((aligned(8)));
+
+/**
+ * @brief   lowest address of the stack guard an MPU region covers
+ */
+static U32 mpu_guard_base(U32 region)
+{
+    MPU->RNR = region;
+    return MPU->RBAR & MPU_RBAR_ADDR_Msk;
+}
+
+/**************************************************************************//**
+ * @brief   	report an MPU fault, called on the fault stack
+ * @param       msp         MSP when the fault was taken
+ * @param       psp         PSP when the fault was taken
+ * @param       excReturn   EXC_RETURN of the fault, bit 2 set if PSP was stacked on
+ * @details     The guards programmed by k_tsk_guard_set always belong to
+ *              gp_current_task. A data access names its address in MMFAR,
+ *              a fault while stacking the exception frame (MSTKERR) leaves
+ *              the address of the frame in the stack pointer it used.
+ *              Only an address inside one of the two guards is an overflow.
+ *****************************************************************************/
+void k_mpu_fault(U32 msp, U32 psp, U32 excReturn)
+{
+    U8   mmfsr  = SCB->CFSR & 0xFF;
+    U32  kGuard = mpu_guard_base(MPU_RGN_K_GUARD);
+    U32  uGuard = mpu_guard_base(MPU_RGN_U_GUARD);
+    U32  addr;
+    char *stack = NULL;
+
+    if (mmfsr & BIT(7)) {               // MMARVALID
+        addr = SCB->MMFAR;
+    } else if (mmfsr & BIT(4)) {        // MSTKERR
+        addr = (excReturn & BIT(2)) ? psp : msp;
+    } else {                            // instruction fetch or unstacking, no address
+        addr = 0;
+    }
+
+    if (addr - kGuard < STACK_GUARD_SIZE) {
+        stack = "kernel";
+    } else if (addr - uGuard < STACK_GUARD_SIZE) {
+        stack = "user";
+    }
+
+    if (stack != NULL) {
+        printf("MemManage: task %d overflowed its %s stack, MMFSR = 0x%x, addr = 0x%x\r\n",
+               gp_current_task->tid, stack, mmfsr, addr);
+    } else {
+        printf("MemManage: task %d, MMFSR = 0x%x, addr = 0x%x\r\n",
+               gp_current_task->tid, mmfsr, addr);
+    }
+    while (1);
+}
+
+/**************************************************************************//**
+ * @brief   	MPU fault handler, reports a hit on a stack guard region
+ * @details     MemManage is set above SVC by k_tsk_guard_init, so an overflow
+ *              of the kernel stack inside an SVC is reported here instead of
+ *              escalating to HardFault. The faulting stack may sit in a guard,
+ *              the report runs on a stack of its own and never returns.
+ *****************************************************************************/
+__asm void MemManage_Handler(void)
+{
+    PRESERVE8
+    MRS     R0, MSP
+    MRS     R1, PSP
+    MOV     R2, LR                              // EXC_RETURN
+    LDR     R3, =__cpp(&g_fault_stack[FAULT_STACK_SIZE >> 2])
+    MSR     MSP, R3
+    B       __cpp(k_mpu_fault)
+    ALIGN
+}
+
 
 /*
  *===========================================================================
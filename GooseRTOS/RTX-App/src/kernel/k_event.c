@@ -0,0 +1,295 @@
+/*
+ ****************************************************************************
+ *
+ *                  UNIVERSITY OF WATERLOO ECE 350 RTX LAB  
+ *
+ *                     Copyright 2020-2022 Yiqing Huang
+ *                          All rights reserved.
+ *---------------------------------------------------------------------------
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  - Redistributions of source code must retain the above copyright
+ *    notice and the following disclaimer.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL COPYRIGHT HOLDERS AND CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *---------------------------------------------------------------------------*/
+ 
+
+/**************************************************************************//**
+ * @file        k_event.c
+ * @brief       kernel event sets, waiting on several sources at once
+ * @version     V1.2021.06
+ * @authors     Yiqing Huang
+ * @date        2021 JUN
+ * @details     Every task has one event set of up to EV_MAX_SOURCES sources:
+ *              its mailbox, its send_msg_zc queue, periodic timers and event
+ *              flags raised by other tasks. wait_any blocks once on all of
+ *              them and returns the id of the source that became ready.
+ *              Whoever makes a source ready calls k_ev_notify, so nothing
+ *              is polled but the timers, once per RTX tick.
+ *****************************************************************************/
+
+#include "k_inc.h"
+#include "k_rtx.h"
+
+
+/*
+ *===========================================================================
+ *                            GLOBAL VARIABLES
+ *===========================================================================
+ */
+
+ev_set_t g_evsets[MAX_TASKS];   // event set of each task, indexed by tid
+
+/*
+ *===========================================================================
+ *                            FUNCTIONS
+ *===========================================================================
+ */
+
+/**
+ * @brief   take the lowest numbered ready source of a task's event set
+ * @return  the source id, -1 if none is ready
+ * @note    a reported timer expiry or flag match is consumed
+ */
+static int k_ev_take(task_t tid)
+{
+    ev_set_t *set = &g_evsets[tid];
+
+    for (int id = 0; id < EV_MAX_SOURCES; id++) {
+        ev_source_t *src = &set->src[id];
+
+        switch (src->kind) {
+        case EV_SRC_MBX:
+            if (g_mbx[tid].count != 0) {
+                return id;
+            }
+            break;
+        case EV_SRC_ZC:
+            if (g_mbx[tid].zcCount != 0) {
+                return id;
+            }
+            break;
+        case EV_SRC_TIMER:
+            if (src->pending != 0) {
+                src->pending--;
+                return id;
+            }
+            break;
+        case EV_SRC_FLAGS:
+            if (set->flags & src->arg) {
+                set->flags &= ~src->arg;
+                return id;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief   wake a task blocked in wait_any if one of its sources is ready
+ * @return  non-zero if the task was woken, the caller decides on
+ *          k_tsk_run_new
+ */
+int k_ev_notify(task_t tid)
+{
+    TCB *p_tcb = &g_tcbs[tid];
+    int id;
+
+    if (p_tcb->state != BLK_RECV ||
+        ((U8 *) p_tcb->svcFrame[6])[-2] != SVC_EV_WAIT) {  // Memory[(Stacked PC) - 2]
+        return 0;
+    }
+    id = k_ev_take(tid);
+    if (id < 0) {
+        return 0;
+    }
+    k_tsk_unblock(p_tcb, id);
+    return 1;
+}
+
+/**
+ * @brief   advance the timer sources of all event sets by one RTX tick
+ * @return  non-zero if a task was woken
+ * @note    called from k_tsk_tick, sets without timers are skipped
+ */
+int k_ev_tick(void)
+{
+    int woken = 0;
+
+    for (task_t tid = 0; tid < MAX_TASKS; tid++) {
+        ev_set_t *set = &g_evsets[tid];
+        int expired = 0;
+
+        if (set->timers == 0) {
+            continue;
+        }
+        for (int id = 0; id < EV_MAX_SOURCES; id++) {
+            ev_source_t *src = &set->src[id];
+
+            if (src->kind == EV_SRC_TIMER && --src->remain == 0) {
+                src->remain = src->arg;
+                src->pending++;
+                expired = 1;
+            }
+        }
+        if (expired) {
+            woken |= k_ev_notify(tid);
+        }
+    }
+    return woken;
+}
+
+/**************************************************************************//**
+ * @brief   add a source to the event set of the calling task
+ * @return  the source id reported by wait_any, RTX_ERR on failure
+ * @param   kind    EV_SRC_MBX, EV_SRC_ZC, EV_SRC_TIMER or EV_SRC_FLAGS
+ * @param   arg     period in RTX ticks of EV_SRC_TIMER, flag mask of
+ *                  EV_SRC_FLAGS, ignored otherwise
+ * @details EV_SRC_MBX is ready while the mailbox holds a message and
+ *          EV_SRC_ZC while a send_msg_zc buffer is queued, wait_any does
+ *          not take them out. An EV_SRC_TIMER source fires every arg ticks
+ *          from now on, each expiry is reported once. EV_SRC_FLAGS is
+ *          ready when ev_signal raised one of the flags in arg, reporting
+ *          it clears those flags. Fails with EINVAL for a bad kind or a
+ *          zero arg where one is needed and ENOMEM when the set is full.
+ *****************************************************************************/
+int k_ev_add(U8 kind, U32 arg)
+{
+#ifdef DEBUG_0
+    printf("k_ev_add: kind=%u, arg=%u\r\n", kind, arg);
+#endif /* DEBUG_0 */
+    ev_set_t *set = &g_evsets[gp_current_task->tid];
+
+    if (kind < EV_SRC_MBX || kind > EV_SRC_FLAGS ||
+        ((kind == EV_SRC_TIMER || kind == EV_SRC_FLAGS) && arg == 0)) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    for (int id = 0; id < EV_MAX_SOURCES; id++) {
+        ev_source_t *src = &set->src[id];
+
+        if (src->kind != EV_SRC_NONE) {
+            continue;
+        }
+        src->kind    = kind;
+        src->arg     = arg;
+        src->remain  = arg;
+        src->pending = 0;
+        if (kind == EV_SRC_TIMER) {
+            set->timers++;
+        }
+        return id;
+    }
+    errno = ENOMEM;
+    return RTX_ERR;
+}
+
+/**
+ * @brief   remove a source from the event set of the calling task
+ */
+int k_ev_del(int id)
+{
+#ifdef DEBUG_0
+    printf("k_ev_del: id=%d\r\n", id);
+#endif /* DEBUG_0 */
+    ev_set_t *set = &g_evsets[gp_current_task->tid];
+
+    if (id < 0 || id >= EV_MAX_SOURCES || set->src[id].kind == EV_SRC_NONE) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    if (set->src[id].kind == EV_SRC_TIMER) {
+        set->timers--;
+    }
+    set->src[id].kind = EV_SRC_NONE;
+    return RTX_OK;
+}
+
+/**
+ * @brief   raise event flags of a task, waking it if it waits for them
+ */
+int k_ev_signal(task_t tid, U32 flags)
+{
+#ifdef DEBUG_0
+    printf("k_ev_signal: tid=%u, flags=0x%x\r\n", tid, flags);
+#endif /* DEBUG_0 */
+    if (tid >= MAX_TASKS || g_tcbs[tid].state == DORMANT) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    g_evsets[tid].flags |= flags;
+    if (k_ev_notify(tid)) {
+        return k_tsk_run_new();     // the woken task may outrank the caller
+    }
+    return RTX_OK;
+}
+
+/**************************************************************************//**
+ * @brief   block until a source of the calling task's event set is ready
+ * @return  the id of the ready source, RTX_ERR on failure
+ * @param   ticks   RTX ticks to wait at most, K_WAIT_FOREVER for no limit
+ * @details With several sources ready the lowest id wins, so add sources in
+ *          order of importance. Fails with ETIMEDOUT when nothing became
+ *          ready in time, at once for zero ticks, and with ENOENT on an
+ *          empty event set.
+ *****************************************************************************/
+int k_wait_any(U32 ticks)
+{
+#ifdef DEBUG_0
+    printf("k_wait_any: ticks=%u\r\n", ticks);
+#endif /* DEBUG_0 */
+    ev_set_t *set = &g_evsets[gp_current_task->tid];
+    int id = k_ev_take(gp_current_task->tid);
+    int n = 0;
+
+    if (id >= 0) {
+        return id;
+    }
+    for (int i = 0; i < EV_MAX_SOURCES; i++) {
+        n += (set->src[i].kind != EV_SRC_NONE);
+    }
+    if (n == 0) {
+        errno = ENOENT;
+        return RTX_ERR;
+    }
+    if (ticks == 0) {
+        errno = ETIMEDOUT;
+        return RTX_ERR;
+    }
+    // whoever makes a source ready hands us its id, see k_ev_notify
+    return k_tsk_block(BLK_RECV, NULL, ticks);
+}
+
+/**
+ * @brief   clear the event set of an exiting task
+ */
+void k_ev_release(task_t tid)
+{
+    ev_set_t *set = &g_evsets[tid];
+
+    for (int id = 0; id < EV_MAX_SOURCES; id++) {
+        set->src[id].kind = EV_SRC_NONE;
+    }
+    set->flags  = 0;
+    set->timers = 0;
+}
+/*
+ *===========================================================================
+ *                             END OF FILE
+ *===========================================================================
+ */
@@ -56,6 +56,84 @@
 
 #define NUM_TASKS 3     // only supports three tasks in the starter code 
                         // due to limited user stack space
+
+#define MPOOL_MAX_ORDER     IRAM2_MAX_BLK_SIZE_LOG2     // largest block order of any pool
+#define NUM_SUB_MPOOLS      MAX_TASKS                   // pools carved out of MPID_IRAM1/2
+#define NUM_MPOOLS          (MAX_MPOOLS + NUM_SUB_MPOOLS)
+
+#define MPOOL_BLK_FREE      1               // freeFlag of a block on a free list
+#define MPOOL_BLK_SHIM      2               // freeFlag of the shim header of an aligned allocation
+#define MPOOL_BLK_LAZY      3               // freeFlag of a block parked on a quick list
+#define MPOOL_BLK_STALE     4               // freeFlag of a header merged into a larger block
+#define MPOOL_BLK_CACHED    5               // freeFlag of a block held in a mem_alloc magazine
+#define MPOOL_BLK_ISR       6               // freeFlag of a block on an ISR stash or the deferred list
+#define MPOOL_LAZY_MAX      8               // quick list watermark of a BUDDY_LAZY pool, per order
+
+#define K_CYCLES()          (DWT->CYCCNT)   // CPU cycle counter, enabled in k_mem_init
+
+/* MPID_IRAM1 blocks stashed for interrupt handlers, see k_mem_isr_alloc */
+#define ISR_STASH_MAX_ORDER 8               // largest stashed block, 256 bytes
+#define ISR_STASH_ORDERS    (ISR_STASH_MAX_ORDER - MIN_BLK_SIZE_LOG2 + 1)
+#define ISR_STASH_LOW       2               // refill below this many blocks per order
+#define ISR_STASH_HIGH      4               // blocks kept per order
+
+/* allocation trace, compiled in with the MEM_TRACE define */
+#define MEM_TRACE_LEN       128             // records kept in the ring, a power of two
+#define MEM_EV_ALLOC        1               // block allocated
+#define MEM_EV_FREE         2               // block freed
+#define MEM_EV_FAIL         3               // allocation failed
+#define MEM_EV_RESIZE       4               // block resized in place
+#define MEM_EV_POOL_CREATE  5               // sub-pool carved out of its parent
+#define MEM_EV_POOL_DESTROY 6               // sub-pool handed back to its parent
+#define MEM_EV_CACHE_FILL   7               // block moved from MPID_IRAM1 into a magazine
+#define MEM_EV_CACHE_DRAIN  8               // block moved from a magazine back to MPID_IRAM1
+#define MEM_EV_CACHED       0x80            // or'ed into ALLOC/FREE served by a magazine
+
+#ifdef MEM_TRACE
+#define MEM_TRACE_EVENT(ev, mpid, blk, size, order) \
+    k_mem_trace((ev), (mpid), (U32)(blk), (size), (order), (U32)__return_address())
+#else
+#define MEM_TRACE_EVENT(ev, mpid, blk, size, order)
+#endif
+
+/* movable allocations, see k_hmem_alloc */
+#define HMEM_NUM_HANDLES    32              // handles shared by all tasks
+
+#define MBX_ZC_DEPTH        8               // send_msg_zc buffers queued per mailbox
+
+/* publish/subscribe, see k_topic_publish */
+#define MAX_TOPICS          8               // topics shared by all tasks
+#define TOPIC_NAME_LEN      16              // including the terminating NUL
+#define MBX_REF_TID         0xFC            // sender_tid of a ring record pointing to a msg_ref_t
+#define MBX_DEAD_TID        0xFB            // sender_tid of a ring record taken by recv_msg_type
+
+/* selective receive, see k_recv_msg_type */
+#define MBX_NUM_TYPES       32              // message types 0 to 31 are indexed, one bit each in a type_mask
+#define MBX_MAX_SIZE        0xFFFF          // ring offsets of the type index are U16
+
+#define UART_RX_BATCH       32              // most keystrokes in one KEY_IN message, see k_mbx_uart_rx
+
+/* mailbox instrumentation, see k_mbx_stats */
+#define MBX_STAMP_DEPTH     16              // ring messages timed at once, later ones are not timed
+#define MBX_STAMP_NONE      0xFFFF          // stampOff of a timed message already taken
+#define MBX_LAT_BASE_LOG2   10              // latency bucket 0 is below 2^10 cycles
+
+#define K_WAIT_FOREVER      0xFFFFFFFF      // k_tsk_block without a timeout
+
+#define STACK_PAINT         0xA5A5A5A5      // fill word of unused stack space
+
+#define STACK_GUARD_SIZE    32              // MPU no-access region at the low end of a stack
+#define MPU_RGN_U_GUARD     6               // MPU region guarding the running task's user stack
+#define MPU_RGN_K_GUARD     7               // MPU region guarding the running task's kernel stack
+
+/* one kernel stack shared by all tasks, compiled in with the K_SHARED_STACK define */
+#ifdef K_SHARED_STACK
+#define NUM_K_STACKS        1               // every SVC runs on g_k_stacks[0]
+#define K_STACK_OF(tid)     (g_k_stacks[0])
+#else
+#define NUM_K_STACKS        MAX_TASKS       // one kernel stack per TCB
+#define K_STACK_OF(tid)     (g_k_stacks[(tid)])
+#endif
 /*
  *===========================================================================
  *                             STRUCTURES
@@ -68,10 +146,20 @@
 // The following offset macros needs to be modified if you modify
 // the positions of msp field in the TCB structure
 #define TCB_MSP_OFFSET  0       // TCB.msp offset 
+#define TCB_PSP_OFFSET  4       // TCB.psp offset
+#define TCB_TIMEDOUT_OFFSET 8   // TCB.timedOut offset
 
 typedef struct tcb {
     U32        *msp;          /**< kernel sp of the task, TCB_MSP_OFFSET = 0  */
-    U32        *pspBase;      /**< base of user sp of the task                */
+    U32        *psp;          /**< K_SHARED_STACK: saved user sp, TCB_PSP_OFFSET = 4 */
+    U8          timedOut;     /**< woken by k_tsk_tick, errno not yet set, TCB_TIMEDOUT_OFFSET = 8 */
+    U32        *svcFrame;     /**< exception frame of the SVC the task blocked in */
+    struct tsk_ready_queue_t *waitq;  /**< wait queue of a blocked task, or NULL */
+    struct tcb *tprev;        /**< prev tcb on the timeout list               */
+    struct tcb *tnext;        /**< next tcb on the timeout list               */
+    U32         tdelta;       /**< ticks after the timeout of tprev            */
+    U32         blockedAt;    /**< K_CYCLES() when the task last blocked       */
+    U32        *pspBase;      /**< base (high address) of the user stack      */
     task_t      tid;          /**< task ID                                    */
     U32         stackSize;    /**< size of the user stack for the task        */
     void        (*ptask)();   /**< task entry address                         */
@@ -80,20 +168,184 @@ typedef struct tcb {
     U8          state;        /**< task state                                 */
     struct tcb *prev;         /**< prev tcb, not used in the starter code     */
     struct tcb *next;         /**< next tcb, not used in the starter code     */
+    mpool_t     heap;         /**< pool serving mem_alloc, MPID_IRAM1 or arena*/
 } TCB;
 
+// the first ALLOCATED_BLK_META_SIZE bytes are kept while the block is allocated
 typedef struct free_memory_block_t {
-    size_t size;
-    U32 freeFlag; 
+    size_t size;              /**< block size in bytes, a power of two        */
+    U8     freeFlag;          /**< non-zero while the block is on a free list */
+    task_t owner;             /**< tid of the task that allocated the block   */
+    mpool_t mpid;             /**< pool whose free lists hold the block       */
+    U8     reserved;
     struct free_memory_block_t* prev;
     struct free_memory_block_t* next;
 } free_memory_block_t;
 
+typedef struct memory_pool_t {
+    U32     start;            /**< first byte of the pool                     */
+    U32     end;              /**< last byte of the pool                      */
+    U8      maxOrder;         /**< log2 of the largest block                  */
+    U8      algo;             /**< allocator algorithm                        */
+    U8      active;           /**< non-zero if the pool id is in use          */
+    mpool_t parent;           /**< pool the region was carved from            */
+    task_t  owner;            /**< creating task, TID_UNK for system pools    */
+    free_memory_block_t* freeList[MPOOL_NUM_ORDERS];  /**< [order - MIN_BLK_SIZE_LOG2] */
+    U16     freeCount[MPOOL_NUM_ORDERS];              /**< length of each free list  */
+    free_memory_block_t* quickList[MPOOL_NUM_ORDERS]; /**< BUDDY_LAZY parked blocks  */
+    U16     quickCount[MPOOL_NUM_ORDERS];             /**< length of each quick list */
+    U16     lazyMax;          /**< quick list watermark, bounds a flush       */
+    U32     inUse;            /**< bytes in allocated blocks                  */
+    U32     peakInUse;        /**< high-water mark of inUse                   */
+    U32     cached;           /**< bytes parked in the mem_alloc magazines    */
+    U32     numAllocs;        /**< successful allocations                     */
+    U32     numFrees;         /**< deallocations                              */
+    U32     numFailures;      /**< failed allocations                         */
+    U32     allocCycles;      /**< cycles spent in successful allocations     */
+} memory_pool_t;
+
+/**
+ * @brief   one allocator event, dumped as is by k_mem_trace_dump
+ * @note    tools/memtrace.py decodes this layout, keep the two in sync
+ */
+typedef struct mem_trace_rec_t {
+    U32 cycles;         // K_CYCLES() when the event was recorded
+    U32 site;           // user return address of the SVC being served
+    U32 kSite;          // kernel caller of the allocator entry point
+    U32 addr;           // block header address, 0 on failure
+    U32 size;           // requested bytes, block bytes on free
+    U8  event;          // MEM_EV_*
+    U8  mpid;           // pool of the block
+    U8  tid;            // calling task
+    U8  order;          // block order
+} mem_trace_rec_t;
+
+/**
+ * @brief   MPID_IRAM1 blocks of one order kept ready for k_mem_alloc
+ */
+typedef struct mem_magazine_t {
+    free_memory_block_t* head;  // blocks linked through next, freeFlag MPOOL_BLK_CACHED
+    U8  count;                  // blocks in the magazine
+} mem_magazine_t;
+
+/**
+ * @brief   one movable MPID_IRAM1 allocation
+ */
+typedef struct hmem_entry_t {
+    void   *ptr;        // user pointer, changed by the compactor while unlocked
+    U8      locks;      // nested hmem_lock calls, the block stays put while non-zero
+    task_t  owner;      // allocating task, TID_UNK while the handle is unused
+} hmem_entry_t;
+
 typedef struct tsk_ready_queue_t {
     TCB *head;
     TCB *tail;
 } tsk_ready_queue_t;
 
+/**
+ * @brief   message queued above MSG_PRIO_NORMAL, allocated from MPID_IRAM2
+ */
+typedef struct mbx_node_t {
+    struct mbx_node_t  *next;   // next message of the same priority
+    U32                 stamp;  // K_CYCLES() when it was queued
+    RTX_MSG_HDR         msg;    // the message, payload follows
+} mbx_node_t;
+
+/**
+ * @brief   statistics of a mailbox, see MBX_STATS
+ * @note    ring messages are timed through a FIFO of (offset, K_CYCLES())
+ *          stamps in ring order, list messages carry their own stamp
+ */
+typedef struct mbx_stats_t {
+    U32     peakUsed;           // high-water mark of used
+    U32     peakCount;          // high-water mark of count
+    U32     nbDrops;            // non-blocking sends refused with ENOSPC
+    U32     blkSendCycles;      // cycles senders spent in BLK_SEND
+    U32     latency[MBX_LAT_BUCKETS];   // see MBX_STATS
+    U32     stampAt[MBX_STAMP_DEPTH];   // K_CYCLES() when the message was queued
+    U16     stampOff[MBX_STAMP_DEPTH];  // ring offset of the message
+    U8      stampHead;          // index of the oldest stamp
+    U8      stampCount;         // stamps in use
+} mbx_stats_t;
+
+/**
+ * @brief   mailbox of a task, a byte ring of RTX_MSG_HDR framed messages
+ * @note    a message may wrap around the end of the ring, so every byte of
+ *          size is usable and size - used is the exact free space.
+ *          Messages sent above MSG_PRIO_NORMAL wait in one list per
+ *          priority beside the ring, their bytes count against size too,
+ *          as do the payloads of published messages behind ring records.
+ *          recv_msg_type can take a message out of the middle of the ring,
+ *          it stays there marked MBX_DEAD_TID until the head passes it.
+ *          The head is never a dead record.
+ */
+typedef struct mailbox_t {
+    U8     *buf;                // ring storage from MPID_IRAM2, NULL without a mailbox
+    U32     size;               // capacity in bytes
+    U32     head;               // offset of the oldest message
+    U32     used;               // bytes queued, in the ring, the lists and behind ref records
+    U32     ringUsed;           // bytes queued in the ring
+    U32     count;              // messages queued
+    mbx_node_t *prioHead[MSG_PRIO_NORMAL];  // oldest message of each higher priority
+    mbx_node_t *prioTail[MSG_PRIO_NORMAL];  // newest message of each higher priority
+    U8      prioMask;           // bit p is set while prioHead[p] != NULL
+    U32     ringTypes;          // bit t is set while typeCount[t] != 0
+    U16     typeCount[MBX_NUM_TYPES];   // live ring messages of each type
+    U16     typeFirst[MBX_NUM_TYPES];   // offset of the oldest of them
+    mbx_stats_t stats;          // see k_mbx_stats
+    tsk_ready_queue_t senders;  // tasks in BLK_SEND on this mailbox, linked through prev/next
+    void   *zc[MBX_ZC_DEPTH];   // send_msg_zc buffers, owned by the mailbox task
+    U8      zcHead;             // index of the oldest buffer in zc
+    U8      zcCount;            // buffers queued in zc
+} mailbox_t;
+
+/* event sets, see k_wait_any */
+#define EV_MAX_SOURCES      8               // sources per event set
+
+typedef struct ev_source_t {
+    U8      kind;               // EV_SRC_*, EV_SRC_NONE for a free slot
+    U32     arg;                // period of EV_SRC_TIMER, flag mask of EV_SRC_FLAGS
+    U32     remain;             // ticks to the next EV_SRC_TIMER expiry
+    U32     pending;            // EV_SRC_TIMER expiries not reported yet
+} ev_source_t;
+
+/**
+ * @brief   event set of a task, the sources wait_any blocks on
+ */
+typedef struct ev_set_t {
+    ev_source_t src[EV_MAX_SOURCES];    // indexed by source id
+    U32     flags;              // raised by ev_signal, cleared when reported
+    U8      timers;             // EV_SRC_TIMER sources in src
+} ev_set_t;
+
+/**
+ * @brief   published message shared by the mailboxes of all subscribers
+ * @note    allocated from MPID_IRAM2 once per topic_publish, freed when the
+ *          last subscriber has taken it
+ */
+typedef struct msg_ref_t {
+    U32         refs;           // ring records still pointing here
+    RTX_MSG_HDR msg;            // the message, payload follows
+} msg_ref_t;
+
+/**
+ * @brief   ring record of a published message
+ * @note    hdr.sender_tid is MBX_REF_TID, only the kernel writes sender_tid
+ *          into a ring so a task cannot forge one
+ */
+typedef __packed struct mbx_ref_rec_t {
+    RTX_MSG_HDR hdr;            // length is sizeof(mbx_ref_rec_t), type that of msg
+    msg_ref_t  *ref;
+} mbx_ref_rec_t;
+
+/**
+ * @brief   named publish/subscribe topic
+ */
+typedef struct topic_entry_t {
+    char    name[TOPIC_NAME_LEN];   // empty while the slot is free
+    U32     subs;                   // bit tid is set for each subscriber
+} topic_entry_t;
+
 /*
  *===========================================================================
  *                             GLOBAL VARIABLES 
@@ -107,11 +359,9 @@ extern const U32 g_k_stack_size;    // kernel stack size
 extern const U32 g_p_stack_size;    // process stack size
 
 // task kernel stacks are statically allocated inside the OS image
-extern U32 g_k_stacks[MAX_TASKS][KERN_STACK_SIZE >> 2] __attribute__((aligned(8)));
+extern U32 g_k_stacks[NUM_K_STACKS][KERN_STACK_SIZE >> 2] __attribute__((aligned(STACK_GUARD_SIZE)));
 
-// process stack for tasks, statically allocated inside the OS image  */
-//extern U32 g_p_stacks[MAX_TASKS][PROC_STACK_SIZE >> 2] __attribute__((aligned(8)));
-extern U32 g_p_stacks[NUM_TASKS][PROC_STACK_SIZE >> 2] __attribute__((aligned(8)));
+// process stacks for tasks are allocated from MPID_IRAM2 by k_alloc_p_stack
 
 // task related globals are defined in k_task.c
 extern TCB *gp_current_task;    // always point to the current RUNNING task
@@ -121,6 +371,28 @@ extern TCB g_tcbs[MAX_TASKS];
 extern TASK_INIT g_null_task_info;
 extern U32 g_num_active_tasks;	// number of non-dormant tasks */
 
+// memory pools are defined in k_mem.c
+extern memory_pool_t g_mpools[NUM_MPOOLS];
+
+extern volatile U8 g_isr_refill;    // ISR stashes need k_mem_isr_refill
+
+// mem_alloc magazines, [band][order - MIN_BLK_SIZE_LOG2]
+extern mem_magazine_t g_mem_cache[MEM_CACHE_BANDS][MEM_CACHE_ORDERS];
+extern MEM_CACHE_CFG g_mem_cache_cfg;
+
+extern hmem_entry_t g_hmem[HMEM_NUM_HANDLES];   // movable MPID_IRAM1 allocations
+
+// mailboxes are defined in k_msg.c, indexed by tid
+extern mailbox_t g_mbx[MAX_TASKS];
+extern topic_entry_t g_topics[MAX_TOPICS];
+
+// event sets are defined in k_event.c, indexed by tid
+extern ev_set_t g_evsets[MAX_TASKS];
+
+#ifdef MEM_TRACE
+extern U32 g_mem_trace_site;    // set by SVC_Handler, recorded with each allocator event
+#endif
+
 extern volatile uint32_t g_timer_count;     // remove if you do not need this variable
 
 #endif  // !K_INC_H_
@@ -52,9 +52,7 @@ The memory map of the OS image may look like the following:
                               |   (for user space heap  ) |
                               |                           |
                  RAM1_START-->|---------------------------|
-                              |                           |
-                              |  unmanaged free space     |
-                              |                           |
+                              |  padding to RAM1_ALIGN    |
 &Image$$RW_IRAM1$$ZI$$Limit-->|---------------------------|-----+-----
                               |         ......            |     ^
                               |---------------------------|     |
@@ -107,8 +105,8 @@ The memory map of the OS image may look like the following:
 // task proc space stack size in bytes, referred by system_a9.c
 // const U32 g_p_stack_size = PROC_STACK_SIZE;
 
-// task kernel stacks
-// U32 g_k_stacks[MAX_TASKS][KERN_STACK_SIZE >> 2] __attribute__((aligned(8)));
+// task kernel stacks, a single one with K_SHARED_STACK
+U32 g_k_stacks[NUM_K_STACKS][KERN_STACK_SIZE >> 2] __attribute__((aligned(STACK_GUARD_SIZE)));
 
 // task process stack (i.e. user stack) for tasks in thread mode
 // remove this bug array in your lab2 code
@@ -116,8 +114,25 @@ The memory map of the OS image may look like the following:
 //U32 g_p_stacks[MAX_TASKS][PROC_STACK_SIZE >> 2] __attribute__((aligned(8)));
 //U32 g_p_stacks[NUM_TASKS][PROC_STACK_SIZE >> 2] __attribute__((aligned(8)));
 
-static free_memory_block_t* iram1FreeList[IRAM1_MAX_BLK_SIZE_LOG2 - MIN_BLK_SIZE_LOG2];
-static free_memory_block_t* iram2FreeList[IRAM2_MAX_BLK_SIZE_LOG2 - MIN_BLK_SIZE_LOG2];
+memory_pool_t g_mpools[NUM_MPOOLS];     // MPID_IRAM1, MPID_IRAM2, then sub-pools
+
+// blocks of MPID_IRAM1 set aside for interrupt handlers, [order - MIN_BLK_SIZE_LOG2]
+free_memory_block_t *g_isr_stash[ISR_STASH_ORDERS];
+U8 g_isr_stash_count[ISR_STASH_ORDERS];
+free_memory_block_t *g_isr_deferred;    // freed by handlers with the stash full
+volatile U8 g_isr_refill;               // set by handlers, served by k_mem_isr_refill
+
+// magazines of MPID_IRAM1 blocks in front of k_mem_alloc, [band][order - MIN_BLK_SIZE_LOG2]
+mem_magazine_t g_mem_cache[MEM_CACHE_BANDS][MEM_CACHE_ORDERS];
+MEM_CACHE_CFG g_mem_cache_cfg;          // watermarks set by k_mem_init, all 0 for no caching
+
+hmem_entry_t g_hmem[HMEM_NUM_HANDLES];  // movable MPID_IRAM1 allocations
+
+#ifdef MEM_TRACE
+mem_trace_rec_t g_mem_trace[MEM_TRACE_LEN]; // ring of the latest allocator events
+U32 g_mem_trace_count;                      // events recorded since boot
+U32 g_mem_trace_site;                       // user return address of the current SVC
+#endif
 
 /*
  *===========================================================================
@@ -125,278 +140,1802 @@ static free_memory_block_t* iram2FreeList[IRAM2_MAX_BLK_SIZE_LOG2 - MIN_BLK_SIZE
  *===========================================================================
  */
 
-/* note list[n] is for blocks with order of n */
-mpool_t k_mpool_create (int algo, U32 start, U32 end){
-    mpool_t mpid = MPID_IRAM1;
-
-#ifdef DEBUG_0
-    printf("k_mpool_init: algo = %d\r\n", algo);
-    printf("k_mpool_init: RAM range: [0x%x, 0x%x].\r\n", start, end);
-#endif /* DEBUG_0 */    
-    
-    if (algo != BUDDY ) {
+/**
+ * @brief   look up the descriptor of an active memory pool
+ * @return  pool pointer, NULL with errno set to EINVAL if mpid is not active
+ */
+static memory_pool_t* k_mpool_get(mpool_t mpid)
+{
+    if (mpid < 0 || mpid >= NUM_MPOOLS || !g_mpools[mpid].active) {
         errno = EINVAL;
-        return RTX_ERR;
+        return NULL;
     }
-    
-    if ( start == RAM1_START) {
-        mpid = MPID_IRAM1;
-        // Create the initial memory block
-        free_memory_block_t* block = (free_memory_block_t*) start;
-        block->size = end - start - ALLOCATED_BLK_META_SIZE;
-        block->freeFlag = 1;
-        block->prev = NULL;
-        block->next = NULL;
-
-        iram1FreeList[IRAM1_MAX_BLK_SIZE_LOG2 - MIN_BLK_SIZE_LOG2 - 1] = block;
-    } else if ( start == RAM2_START) {
-        mpid = MPID_IRAM2;
-        // add your own code
-        free_memory_block_t* block = (free_memory_block_t*) start;
-        block->size = start - end - ALLOCATED_BLK_META_SIZE;
-        block->freeFlag = 1;
-        block->prev = NULL;
-        block->next = NULL;
-
-        iram2FreeList[IRAM2_MAX_BLK_SIZE_LOG2 - MIN_BLK_SIZE_LOG2 - 1] = block;
-    } else {
-        errno = EINVAL;
-        return RTX_ERR;
+    return &g_mpools[mpid];
+}
+
+/**
+ * @brief   tid recorded as the owner of newly allocated blocks
+ */
+static task_t k_mpool_owner(void)
+{
+    return (gp_current_task != NULL) ? gp_current_task->tid : TID_UNK;
+}
+
+#ifdef MEM_TRACE
+/**
+ * @brief   record one allocator event in the trace ring, overwriting the oldest
+ */
+static void k_mem_trace(U8 event, mpool_t mpid, U32 addr, U32 size, U8 order, U32 kSite)
+{
+    mem_trace_rec_t *rec = &g_mem_trace[g_mem_trace_count & (MEM_TRACE_LEN - 1)];
+
+    rec->cycles = K_CYCLES();
+    rec->site   = g_mem_trace_site;
+    rec->kSite  = kSite;
+    rec->addr   = addr;
+    rec->size   = size;
+    rec->event  = event;
+    rec->mpid   = mpid;
+    rec->tid    = k_mpool_owner();
+    rec->order  = order;
+    g_mem_trace_count++;
+}
+
+/**
+ * @brief   write a little-endian word to UART1
+ */
+static void k_mem_trace_put(U32 word)
+{
+    for (U8 i = 0; i < 4; i++) {
+        uart1_put_char((char)(word >> (i << 3)));
     }
-    
-    return mpid;
 }
 
-void *k_mpool_alloc (mpool_t mpid, size_t size)
+/**************************************************************************//**
+ * @brief   dump the allocation trace in binary over UART1
+ * @return  number of records written
+ * @details The dump is a header followed by the records oldest first:
+ *          magic "MTRC", version and record size (U16 each), record count,
+ *          events since boot, core clock in Hz, then start and end of
+ *          MPID_IRAM1 and MPID_IRAM2. tools/memtrace.py finds the magic in
+ *          the console stream, so printf output around it does no harm.
+ *          UART1 is polled, the caller is held up for the whole dump.
+ *****************************************************************************/
+int k_mem_trace_dump(void)
 {
-#ifdef DEBUG_0
-    printf("k_mpool_alloc: mpid = %d, size = %d, 0x%x\r\n", mpid, size, size);
-#endif /* DEBUG_0 */
-    free_memory_block_t** freeList;
-    int maxBlkSizeLog2;
+    U32 count = (g_mem_trace_count < MEM_TRACE_LEN) ? g_mem_trace_count : MEM_TRACE_LEN;
+    U32 first = g_mem_trace_count - count;
 
-    if(size == NULL){
-        return NULL;
+    k_mem_trace_put(0x4352544D);        // "MTRC"
+    k_mem_trace_put(2 | (sizeof(mem_trace_rec_t) << 16));
+    k_mem_trace_put(count);
+    k_mem_trace_put(g_mem_trace_count);
+    k_mem_trace_put(SystemCoreClock);
+    for (mpool_t mpid = MPID_IRAM1; mpid <= MPID_IRAM2; mpid++) {
+        k_mem_trace_put(g_mpools[mpid].start);
+        k_mem_trace_put(g_mpools[mpid].end);
     }
-    if (mpid == MPID_IRAM1) {
-        freeList = iram1FreeList;
-        maxBlkSizeLog2 = IRAM1_MAX_BLK_SIZE_LOG2;
-    } else if (mpid == MPID_IRAM2) {
-        freeList = iram2FreeList;
-        maxBlkSizeLog2 = IRAM2_MAX_BLK_SIZE_LOG2;
-    } else {
-        errno = EINVAL;
-        return RTX_ERR;
+
+    for (U32 i = first; i < g_mem_trace_count; i++) {
+        mem_trace_rec_t *rec = &g_mem_trace[i & (MEM_TRACE_LEN - 1)];
+
+        k_mem_trace_put(rec->cycles);
+        k_mem_trace_put(rec->site);
+        k_mem_trace_put(rec->kSite);
+        k_mem_trace_put(rec->addr);
+        k_mem_trace_put(rec->size);
+        k_mem_trace_put(rec->event | (rec->mpid << 8) | (rec->tid << 16) | (rec->order << 24));
     }
+    return count;
+}
+#endif /* MEM_TRACE */
 
-     // Calculate the required block size
-    size_t blockSize = size + ALLOCATED_BLK_META_SIZE;  // Including size info and padding
-    blockSize = (blockSize + 7) & ~0x07;  // Align to 8 bytes
+/**
+ * @brief   push a block to the head of the free list of the given order
+ */
+static void k_mpool_push(memory_pool_t* pool, free_memory_block_t* block, U8 order)
+{
+    free_memory_block_t** head = &pool->freeList[order - MIN_BLK_SIZE_LOG2];
 
-    // Find the appropriate block size in the free list
-    int blkSizeLog2 = log_two_ceil(blockSize);
-    if (blkSizeLog2 < MIN_BLK_SIZE_LOG2) {
-        blkSizeLog2 = MIN_BLK_SIZE_LOG2;
-    } else if (blkSizeLog2 > maxBlkSizeLog2) {
-        return NULL;  // Requested size exceeds maximum block size
+    block->size = 1U << order;
+    block->freeFlag = MPOOL_BLK_FREE;
+    block->mpid = pool - g_mpools;
+    block->prev = NULL;
+    block->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = block;
     }
+    *head = block;
+    pool->freeCount[order - MIN_BLK_SIZE_LOG2]++;
+}
 
-    free_memory_block_t* block;
-    U8 i = blkSizeLog2;
-    while((block == NULL) && (i <= maxBlkSizeLog2)){
-        block = freeList[i];
-        ++i;
+/**
+ * @brief   unlink a block from the free list of the given order
+ */
+static void k_mpool_remove(memory_pool_t* pool, free_memory_block_t* block, U8 order)
+{
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        pool->freeList[order - MIN_BLK_SIZE_LOG2] = block->next;
     }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+    block->freeFlag = MPOOL_BLK_STALE;      // until the allocator reuses the header
+    pool->freeCount[order - MIN_BLK_SIZE_LOG2]--;
+}
+
+/**
+ * @brief   order of the smallest block that holds size bytes of user data
+ */
+static U8 k_mpool_order(size_t size)
+{
+    U8 order = log_two_ceil(size + ALLOCATED_BLK_META_SIZE);
+
+    return (order < MIN_BLK_SIZE_LOG2) ? MIN_BLK_SIZE_LOG2 : order;
+}
+
+/**
+ * @brief   take a block of the given order off the free lists,
+ *          splitting the smallest larger free block if needed
+ * @return  the block, NULL if no free block is large enough
+ */
+static free_memory_block_t* k_buddy_split(memory_pool_t* pool, U8 order)
+{
+    free_memory_block_t* block;
+    U8 i = order;
 
-    if(i > maxBlkSizeLog2){
-        // there was no memory block large enough that was free
+    while (i <= pool->maxOrder && pool->freeList[i - MIN_BLK_SIZE_LOG2] == NULL) {
+        i++;
+    }
+    if (i > pool->maxOrder) {
         return NULL;
     }
 
-    // Remove the block from it's curret linked list
-    freeList[i] = block->next;
+    block = pool->freeList[i - MIN_BLK_SIZE_LOG2];
+    k_mpool_remove(pool, block, i);
 
-    while(i + MIN_BLK_SIZE_LOG2 > blkSizeLog2){
+    // keep splitting the block in two, returning the upper half to the free lists
+    while (i > order) {
         i--;
-        // keep splitting the current smallest suitable block into 2 buddies until it is blkSizeLog2 size
-        free_memory_block_t* buddy = (free_memory_block_t*)((char*)block + (block->size >> 1));
-        buddy->size = block->size >> 1;
-
-        block->size >>= 1;
-        // block->next = buddy;
-
-        // Update the free list at the corresponding index
-        buddy->next = freeList[i];
-        buddy->prev = NULL;
-        if (freeList[i] != NULL) {
-            freeList[i]->prev = buddy;
+        k_mpool_push(pool, (free_memory_block_t *)((char *)block + (1U << i)), i);
+    }
+    return block;
+}
+
+/**
+ * @brief   buddy of a block of the given order, if it is a whole free block
+ * @return  the buddy, NULL if it is allocated, split, parked or past the pool end
+ */
+static free_memory_block_t* k_buddy_of(memory_pool_t* pool, free_memory_block_t* block, U8 order)
+{
+    // buddies are computed relative to the pool start
+    U32 offset = ((U32)block - pool->start) ^ (1U << order);
+    free_memory_block_t* buddy = (free_memory_block_t *)(pool->start + offset);
+
+    if (order >= pool->maxOrder || pool->start + offset + (1U << order) - 1 > pool->end) {
+        return NULL;
+    }
+    // the root of a sub-pool carved out of this pool looks free here too
+    if (buddy->freeFlag != MPOOL_BLK_FREE || buddy->size != (1U << order) ||
+        buddy->mpid != pool - g_mpools) {
+        return NULL;
+    }
+    return buddy;
+}
+
+/**
+ * @brief   put a block on the free lists, coalescing it with its free buddies
+ * @note    blocks parked on a quick list are not free to their buddies
+ */
+static void k_buddy_merge(memory_pool_t* pool, free_memory_block_t* block)
+{
+    free_memory_block_t* buddy;
+    U8 order = log_two_floor(block->size);
+
+    // an absorbed header must not pass for an allocated block on a double free
+    block->freeFlag = MPOOL_BLK_STALE;
+
+    while ((buddy = k_buddy_of(pool, block, order)) != NULL) {
+        k_mpool_remove(pool, buddy, order);
+        if (buddy < block) {
+            block = buddy;
         }
-        freeList[i] = buddy;
+        order++;
     }
-    block->freeFlag = 0;
 
-    return (void *)((char *)block + ALLOCATED_BLK_META_SIZE);
+    k_mpool_push(pool, block, order);
 }
 
-int k_mpool_dealloc(mpool_t mpid, void *ptr)
+/**
+ * @brief   merge the blocks parked on one quick list of a BUDDY_LAZY pool
+ * @return  number of blocks merged back
+ * @note    costs at most lazyMax merges
+ */
+static U32 k_lazy_flush_order(memory_pool_t* pool, U8 i)
 {
-#ifdef DEBUG_0
-    printf("k_mpool_dealloc: mpid = %d, ptr = 0x%x\r\n", mpid, ptr);
-#endif /* DEBUG_0 */
-    free_memory_block_t** freeList;
+    U32 count = 0;
 
-    if(ptr == NULL){
-        return RTX_OK;
+    while (pool->quickList[i] != NULL) {
+        free_memory_block_t* block = pool->quickList[i];
+
+        pool->quickList[i] = block->next;
+        pool->quickCount[i]--;
+        k_buddy_merge(pool, block);
+        count++;
     }
-    if (mpid == MPID_IRAM1) {
-        if(ptr < RAM1_START || ptr > RAM1_END){
-            errno = EFAULT;
-            return RTX_ERR;
-        }
-        freeList = iram1FreeList;
-    } else if (mpid == MPID_IRAM2) {
-        if(ptr < RAM2_START || ptr > RAM2_END){
-            errno = EFAULT;
-            return RTX_ERR;
-        }
-        freeList = iram2FreeList;
-    } else {
-        errno = EINVAL;
-        return RTX_ERR;  // Invalid memory pool ID
+    return count;
+}
+
+/**
+ * @brief   merge every block parked on the quick lists of a BUDDY_LAZY pool
+ * @return  number of blocks merged back
+ * @note    costs at most MPOOL_NUM_ORDERS * lazyMax merges
+ */
+static U32 k_lazy_flush(memory_pool_t* pool)
+{
+    U32 count = 0;
+
+    for (U8 i = 0; i < MPOOL_NUM_ORDERS; i++) {
+        count += k_lazy_flush_order(pool, i);
     }
-    free_memory_block_t* freedBlock = (free_memory_block_t *)(ptr - ALLOCATED_BLK_META_SIZE);
-    freedBlock->freeFlag = 1;
-    // Get the address of the binary buddy of the block
-    free_memory_block_t* buddy = (free_memory_block_t *)((char *)freedBlock ^ freedBlock->size);
-
-    U8 index = log_two_ceil(freedBlock->size);
-
-    // Keep coalescing until we reach a point where the binary buddy is not free
-    while(buddy->freeFlag){
-        // remove the buddy from the free block list it is currently in
-        free_memory_block_t* prevBlock = buddy->prev;
-        free_memory_block_t* nextBlock = buddy->next;
-        if(prevBlock != NULL){
-            prevBlock->next = nextBlock;
-        } else {
-            freeList[index] = nextBlock;
-        }
-        if(nextBlock != NULL){
-            nextBlock->prev = prevBlock;
+    return count;
+}
+
+/**
+ * @brief   take a block of the given order out of the pool, no statistics
+ * @return  header of the block, NULL if no block is large enough
+ * @details A BUDDY_LAZY pool first reuses a parked block of the same order
+ *          in O(1). The quick lists are only merged back when the free
+ *          lists cannot serve the request.
+ */
+static free_memory_block_t* k_buddy_take(memory_pool_t* pool, U8 order)
+{
+    free_memory_block_t* block = NULL;
+
+    if (pool->algo == BUDDY_LAZY && order <= pool->maxOrder) {
+        block = pool->quickList[order - MIN_BLK_SIZE_LOG2];
+        if (block != NULL) {
+            pool->quickList[order - MIN_BLK_SIZE_LOG2] = block->next;
+            pool->quickCount[order - MIN_BLK_SIZE_LOG2]--;
         }
+    }
+    if (block == NULL) {
+        block = k_buddy_split(pool, order);
+    }
+    if (block == NULL && pool->algo == BUDDY_LAZY && k_lazy_flush(pool) != 0) {
+        block = k_buddy_split(pool, order);
+    }
+    if (block != NULL) {
+        block->size = 1U << order;
+    }
+    return block;
+}
 
-        // coalesce the two blocks
-        freedBlock->size <<= 1;
-        buddy->size <<= 1;
-        buddy = (free_memory_block_t *)((char *)freedBlock ^ freedBlock->size);
-        ++index;
+/**
+ * @brief   put a block back into the pool, no statistics
+ * @details A BUDDY_LAZY pool parks the block on the quick list of its order
+ *          in O(1) while that list is below lazyMax. Past the watermark the
+ *          block is coalesced right away, as in a BUDDY pool.
+ */
+static void k_buddy_put(memory_pool_t* pool, free_memory_block_t* block)
+{
+    U8 i = log_two_floor(block->size) - MIN_BLK_SIZE_LOG2;
+
+    if (pool->algo == BUDDY_LAZY && pool->quickCount[i] < pool->lazyMax) {
+        block->freeFlag = MPOOL_BLK_LAZY;
+        block->next = pool->quickList[i];
+        pool->quickList[i] = block;
+        pool->quickCount[i]++;
+        return;
     }
+    k_buddy_merge(pool, block);
+}
 
-    freedBlock->freeFlag = 1;
-    // make sure freedblock starts at the address of the binary buddy that was at a lower part of memory
-    freedBlock = (free_memory_block_t *)((char *)freedBlock & ~(freedBlock->size >> 1));
-    freedBlock->next = freeList[index];
-    freeList[index] = freedBlock;
+static U32 k_mem_cache_flush(void);
 
-    return RTX_OK; 
+/**
+ * @brief   allocate a block of the given order from the pool
+ * @return  header of the allocated block, NULL if no block is large enough
+ * @details Blocks parked in the mem_alloc magazines are handed back to
+ *          MPID_IRAM1 before the allocation is given up.
+ */
+static free_memory_block_t* k_buddy_alloc(memory_pool_t* pool, U8 order)
+{
+    U32 startCycles = K_CYCLES();
+    free_memory_block_t* block = k_buddy_take(pool, order);
+
+    if (block == NULL && pool == &g_mpools[MPID_IRAM1] && k_mem_cache_flush() != 0) {
+        block = k_buddy_take(pool, order);
+    }
+    if (block == NULL) {
+        pool->numFailures++;
+        return NULL;
+    }
+
+    block->freeFlag = 0;
+    block->owner = k_mpool_owner();
+
+    pool->inUse += block->size;
+    if (pool->inUse > pool->peakInUse) {
+        pool->peakInUse = pool->inUse;
+    }
+    pool->numAllocs++;
+    pool->allocCycles += K_CYCLES() - startCycles;
+    return block;
 }
 
-int k_mpool_dump (mpool_t mpid)
+/**
+ * @brief   return a block to the pool
+ */
+static void k_buddy_free(memory_pool_t* pool, free_memory_block_t* block)
 {
-#ifdef DEBUG_0
-    printf("k_mpool_dump: mpid = %d\r\n", mpid);
-#endif /* DEBUG_0 */
-    free_memory_block_t** freeList;
-    U8 listLen;
+    pool->inUse -= block->size;
+    pool->numFrees++;
+    k_buddy_put(pool, block);
+}
 
-    if (mpid == MPID_IRAM1) {
-        if(ptr < RAM1_START || ptr > RAM1_END){
-            errno = EFAULT;
+/**
+ * @brief   map a user pointer back to its allocated block header
+ * @return  block header, NULL if ptr was not returned by an allocation from the pool
+ */
+static free_memory_block_t* k_mpool_block_of(memory_pool_t* pool, void *ptr)
+{
+    U32 addr = (U32)ptr - ALLOCATED_BLK_META_SIZE;
+    free_memory_block_t* block = (free_memory_block_t *)addr;
+    U32 offset;
+
+    if ((U32)ptr < pool->start + ALLOCATED_BLK_META_SIZE || (U32)ptr > pool->end) {
+        return NULL;
+    }
+    // an aligned allocation keeps a shim header holding the distance back to its block
+    if (block->freeFlag == MPOOL_BLK_SHIM) {
+        offset = block->size;
+        if ((offset & (ALLOCATED_BLK_META_SIZE - 1)) || offset <= ALLOCATED_BLK_META_SIZE ||
+            (U32)ptr - pool->start < offset) {
+            return NULL;
+        }
+        addr = (U32)ptr - offset;
+        block = (free_memory_block_t *)addr;
+    }
+    if ((addr - pool->start) & (MIN_BLK_SIZE - 1)) {
+        return NULL;
+    }
+    // any non-zero flag, MPOOL_BLK_ISR included, means the block is already freed
+    if (block->freeFlag || block->size < MIN_BLK_SIZE || (block->size & (block->size - 1))) {
+        return NULL;
+    }
+    if (((addr - pool->start) & (block->size - 1)) || addr + block->size - 1 > pool->end) {
+        return NULL;
+    }
+    if ((U32)ptr - addr >= block->size) {
+        return NULL;
+    }
+    return block;
+}
+
+/**
+ * @brief   resize an allocated block in place
+ * @return  RTX_OK if the block now has the given order, RTX_ERR if growing
+ *          needs a buddy that is allocated, split or past the pool end
+ * @details Growing only merges with upper buddies, so the block address and
+ *          the user data stay put. Shrinking splits the block and returns the
+ *          upper halves to the free lists, their buddies are still in use.
+ */
+static int k_buddy_resize(memory_pool_t* pool, free_memory_block_t* block, U8 order)
+{
+    U32 offset = (U32)block - pool->start;
+    U8 cur = log_two_floor(block->size);
+    U8 i;
+
+    if (order > pool->maxOrder) {
+        return RTX_ERR;
+    }
+    for (i = cur; i < order; i++) {
+        free_memory_block_t* buddy = (free_memory_block_t *)((U32)block + (1U << i));
+
+        if ((offset & (1U << i)) || (U32)block + (2U << i) - 1 > pool->end) {
             return RTX_ERR;
         }
-        freeList = iram1FreeList;
-        listLen = IRAM1_MAX_BLK_SIZE_LOG2 - MIN_BLK_SIZE_LOG2;
-    } else if (mpid == MPID_IRAM2) {
-        if(ptr < RAM2_START || ptr > RAM2_END){
-            errno = EFAULT;
+        if (buddy->freeFlag != MPOOL_BLK_FREE || buddy->size != (1U << i) ||
+            buddy->mpid != pool - g_mpools) {
             return RTX_ERR;
         }
-        freeList = iram2FreeList;
-        listLen = IRAM2_MAX_BLK_SIZE_LOG2 - MIN_BLK_SIZE_LOG2;
-    } else {
-        errno = EINVAL;
-        return RTX_ERR;  // Invalid memory pool ID
     }
-    size_t freeBlockCount = 0;
-    for(U8 i = 0; i < listLen; ++i){
-        free_memory_block_t* currentBlk = freeList[i];
-        while(currentBlk != NULL){
-            printf("%x: %x\n", currentBlk, currentBlk->size);
-            currentBlk = currentBlk->next;
-            freeBlockCount++;
-        }
+
+    for (i = cur; i < order; i++) {
+        k_mpool_remove(pool, (free_memory_block_t *)((U32)block + (1U << i)), i);
+    }
+    for (i = cur; i > order; ) {
+        i--;
+        k_mpool_push(pool, (free_memory_block_t *)((U32)block + (1U << i)), i);
     }
-    printf("%zu free memory block(s) found\n", freeBlockCount);
 
-    return 0;
+    pool->inUse = pool->inUse - block->size + (1U << order);
+    if (pool->inUse > pool->peakInUse) {
+        pool->peakInUse = pool->inUse;
+    }
+    block->size = 1U << order;
+    return RTX_OK;
 }
- 
-int k_mem_init(int algo)
+
+/**
+ * @brief   copy size bytes, word by word when both ends are word aligned
+ */
+void k_mem_copy(void *dst, const void *src, U32 size)
 {
-#ifdef DEBUG_0
-    printf("k_mem_init: algo = %d\r\n", algo);
-#endif /* DEBUG_0 */
-        
-    if ( k_mpool_create(algo, RAM1_START, RAM1_END) < 0 ) {
-        return RTX_ERR;
-    }
-    
-    if ( k_mpool_create(algo, RAM2_START, RAM2_END) < 0 ) {
-        return RTX_ERR;
+    if ((((U32)dst | (U32)src | size) & 0x03) == 0) {
+        for (U32 i = 0; i < (size >> 2); i++) {
+            ((U32 *)dst)[i] = ((const U32 *)src)[i];
+        }
+    } else {
+        for (U32 i = 0; i < size; i++) {
+            ((U8 *)dst)[i] = ((const U8 *)src)[i];
+        }
     }
-    
-    return RTX_OK;
 }
 
 /**
- * @brief allocate kernel stack statically
+ * @brief   set up pool mpid over [start, end]
+ * @details A range that is not a power of two is seeded with one root block
+ *          per set bit of its size, largest first. Every root then starts at
+ *          a multiple of twice its own size, so its buddy always falls past
+ *          the end of the pool and roots never coalesce with each other.
  */
-U32* k_alloc_k_stack(task_t tid)
+static void k_mpool_init(mpool_t mpid, int algo, U32 start, U32 end)
 {
-    
-    if ( tid >= MAX_TASKS) {
-        errno = EAGAIN;
-        return NULL;
+    memory_pool_t* pool = &g_mpools[mpid];
+    U32 size = (end - start + 1) & ~(MIN_BLK_SIZE - 1);
+    U32 root = start;
+
+    for (U8 i = 0; i < MPOOL_NUM_ORDERS; i++) {
+        pool->freeList[i] = NULL;
+        pool->freeCount[i] = 0;
+        pool->quickList[i] = NULL;
+        pool->quickCount[i] = 0;
     }
-    U32 *sp = g_k_stacks[tid+1];
-    
-    // 8B stack alignment adjustment
-    if ((U32)sp & 0x04) {   // if sp not 8B aligned, then it must be 4B aligned
-        sp--;               // adjust it to 8B aligned
+    pool->lazyMax     = MPOOL_LAZY_MAX;
+    pool->inUse       = 0;
+    pool->cached      = 0;
+    pool->peakInUse   = 0;
+    pool->numAllocs   = 0;
+    pool->numFrees    = 0;
+    pool->numFailures = 0;
+    pool->allocCycles = 0;
+    pool->start    = start;
+    pool->end      = start + size - 1;
+    pool->maxOrder = log_two_floor(size);
+    pool->algo     = algo;
+    pool->parent   = mpid;
+    pool->owner    = TID_UNK;
+    pool->active   = 1;
+
+    for (S8 order = pool->maxOrder; order >= MIN_BLK_SIZE_LOG2; order--) {
+        if (size & (1U << order)) {
+            k_mpool_push(pool, (free_memory_block_t *)root, order);
+            root += 1U << order;
+        }
     }
-    return sp;
 }
 
 /**
- * @brief allocate user/process stack statically
- * @attention  you should not use this function in your lab
+ * @brief   find an unused sub-pool id
+ * @return  the pool id, RTX_ERR with errno set to EAGAIN if all are in use
  */
-
-U32* k_alloc_p_stack(task_t tid)
+static mpool_t k_mpool_slot(void)
 {
-    if ( tid >= NUM_TASKS ) {
-        errno = EAGAIN;
-        return NULL;
+    for (mpool_t mpid = MAX_MPOOLS; mpid < NUM_MPOOLS; mpid++) {
+        if (!g_mpools[mpid].active) {
+            return mpid;
+        }
     }
+    errno = EAGAIN;
+    return RTX_ERR;
+}
+
+/**************************************************************************//**
+ * @brief   create a buddy memory pool over the RAM range [start, end]
+ * @return  the pool id on success, RTX_ERR on failure
+ * @note    RAM1_START and RAM2_START map to MPID_IRAM1 and MPID_IRAM2,
+ *          any other range gets the first unused sub-pool id.
+ *          The range may have any size of at least MIN_BLK_SIZE, a tail
+ *          smaller than MIN_BLK_SIZE is left unmanaged.
+ *****************************************************************************/
+mpool_t k_mpool_create (int algo, U32 start, U32 end){
+    mpool_t mpid;
+    U32 size = end - start + 1;
+
+#ifdef DEBUG_0
+    printf("k_mpool_init: algo = %d\r\n", algo);
+    printf("k_mpool_init: RAM range: [0x%x, 0x%x].\r\n", start, end);
+#endif /* DEBUG_0 */    
     
-    U32 *sp = g_p_stacks[tid+1];
-    
-    
-    // 8B stack alignment adjustment
-    if ((U32)sp & 0x04) {   // if sp not 8B aligned, then it must be 4B aligned
-        sp--;               // adjust it to 8B aligned
+    if (algo != BUDDY && algo != BUDDY_LAZY) {
+        errno = EINVAL;
+        return RTX_ERR;
     }
-    return sp;
+    if (end <= start || (start & 0x07) ||
+        size < MIN_BLK_SIZE || log_two_floor(size) > MPOOL_MAX_ORDER) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    
+    if ( start == RAM1_START) {
+        mpid = MPID_IRAM1;
+    } else if ( start == RAM2_START) {
+        mpid = MPID_IRAM2;
+    } else {
+        mpid = k_mpool_slot();
+        if (mpid == RTX_ERR) {
+            return RTX_ERR;
+        }
+    }
+
+    k_mpool_init(mpid, algo, start, end);
+    return mpid;
+}
+
+/**
+ * @brief   carve a sub-pool out of a free block of the parent pool
+ * @return  the sub-pool id on success, RTX_ERR on failure
+ */
+mpool_t k_mpool_create_sub(mpool_t parent, int algo, size_t size)
+{
+    memory_pool_t* pool = k_mpool_get(parent);
+    free_memory_block_t* block;
+    mpool_t mpid;
+    U8 order;
+
+    if (pool == NULL) {
+        return RTX_ERR;
+    }
+    if (algo != BUDDY && algo != BUDDY_LAZY) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    order = log_two_ceil(size);
+    if (order < MIN_BLK_SIZE_LOG2) {
+        order = MIN_BLK_SIZE_LOG2;
+    }
+    if (size == 0 || order > pool->maxOrder) {
+        errno = ENOMEM;
+        return RTX_ERR;
+    }
+
+    mpid = k_mpool_slot();
+    if (mpid == RTX_ERR) {
+        return RTX_ERR;
+    }
+    block = k_buddy_alloc(pool, order);
+    if (block == NULL) {
+        errno = ENOMEM;
+        return RTX_ERR;
+    }
+
+    k_mpool_init(mpid, algo, (U32)block, (U32)block + (1U << order) - 1);
+    MEM_TRACE_EVENT(MEM_EV_POOL_CREATE, mpid, block, parent, order);
+    g_mpools[mpid].parent = parent;
+    g_mpools[mpid].owner  = k_mpool_owner();
+    return mpid;
+}
+
+/**
+ * @brief   hand the whole region of a sub-pool back to its parent in one free,
+ *          regardless of what is still allocated inside it
+ */
+int k_mpool_destroy(mpool_t mpid)
+{
+    memory_pool_t* pool = k_mpool_get(mpid);
+    free_memory_block_t* block;
+
+    if (pool == NULL) {
+        return RTX_ERR;
+    }
+    if (mpid < MAX_MPOOLS) {
+        errno = EPERM;
+        return RTX_ERR;
+    }
+
+    // rebuild the header the parent allocator expects at the region start
+    block = (free_memory_block_t *)pool->start;
+    block->size = pool->end - pool->start + 1;
+    block->freeFlag = 0;
+    pool->active = 0;
+    MEM_TRACE_EVENT(MEM_EV_POOL_DESTROY, mpid, block, block->size, log_two_floor(block->size));
+
+    k_buddy_free(&g_mpools[pool->parent], block);
+    return RTX_OK;
+}
+
+void *k_mpool_alloc (mpool_t mpid, size_t size)
+{
+#ifdef DEBUG_0
+    printf("k_mpool_alloc: mpid = %d, size = %d, 0x%x\r\n", mpid, size, size);
+#endif /* DEBUG_0 */
+    memory_pool_t* pool = k_mpool_get(mpid);
+    free_memory_block_t* block;
+
+    if (pool == NULL || size == 0) {
+        return NULL;
+    }
+    if (size > (1U << pool->maxOrder) - ALLOCATED_BLK_META_SIZE) {
+        errno = ENOMEM;
+        return NULL;  // Requested size exceeds maximum block size
+    }
+
+    block = k_buddy_alloc(pool, k_mpool_order(size));
+    if (block == NULL) {
+        MEM_TRACE_EVENT(MEM_EV_FAIL, mpid, 0, size, k_mpool_order(size));
+        errno = ENOMEM;
+        return NULL;
+    }
+    MEM_TRACE_EVENT(MEM_EV_ALLOC, mpid, block, size, log_two_floor(block->size));
+
+    return (void *)((char *)block + ALLOCATED_BLK_META_SIZE);
+}
+
+int k_mpool_dealloc(mpool_t mpid, void *ptr)
+{
+#ifdef DEBUG_0
+    printf("k_mpool_dealloc: mpid = %d, ptr = 0x%x\r\n", mpid, ptr);
+#endif /* DEBUG_0 */
+    memory_pool_t* pool;
+    free_memory_block_t* block;
+
+    if (ptr == NULL) {
+        return RTX_OK;
+    }
+    pool = k_mpool_get(mpid);
+    if (pool == NULL) {
+        return RTX_ERR;  // Invalid memory pool ID
+    }
+
+    block = k_mpool_block_of(pool, ptr);
+    if (block == NULL) {
+        errno = EFAULT;
+        return RTX_ERR;
+    }
+
+    MEM_TRACE_EVENT(MEM_EV_FREE, mpid, block, block->size, log_two_floor(block->size));
+    k_buddy_free(pool, block);
+    return RTX_OK; 
+}
+
+/**************************************************************************//**
+ * @brief   change the size of an allocation, keeping its contents
+ * @return  the possibly moved user pointer, NULL on failure with ptr
+ *          left untouched
+ * @details The block grows in place when its upper buddies are free and
+ *          shrinks in place by splitting. Only when neither works is the
+ *          data moved to a new block and the old block freed.
+ *          A NULL ptr allocates, a zero size frees and returns NULL.
+ *****************************************************************************/
+void *k_mpool_realloc(mpool_t mpid, void *ptr, size_t size)
+{
+#ifdef DEBUG_0
+    printf("k_mpool_realloc: mpid = %d, ptr = 0x%x, size = %d\r\n", mpid, ptr, size);
+#endif /* DEBUG_0 */
+    memory_pool_t* pool;
+    free_memory_block_t* block;
+    void *newPtr;
+    U32 oldSize;
+
+    if (ptr == NULL) {
+        return k_mpool_alloc(mpid, size);
+    }
+    if (size == 0) {
+        k_mpool_dealloc(mpid, ptr);
+        return NULL;
+    }
+    pool = k_mpool_get(mpid);
+    if (pool == NULL) {
+        return NULL;
+    }
+    block = k_mpool_block_of(pool, ptr);
+    if (block == NULL) {
+        errno = EFAULT;
+        return NULL;
+    }
+    if (size > (1U << pool->maxOrder) - ALLOCATED_BLK_META_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // aligned allocations always move, their data does not start at the header
+    if ((U32)ptr == (U32)block + ALLOCATED_BLK_META_SIZE &&
+        k_buddy_resize(pool, block, k_mpool_order(size)) == RTX_OK) {
+        MEM_TRACE_EVENT(MEM_EV_RESIZE, mpid, block, size, k_mpool_order(size));
+        return ptr;
+    }
+
+    newPtr = k_mpool_alloc(mpid, size);
+    if (newPtr == NULL) {
+        return NULL;
+    }
+    oldSize = block->size - ((U32)ptr - (U32)block);
+    k_mem_copy(newPtr, ptr, (oldSize < size) ? oldSize : size);
+    MEM_TRACE_EVENT(MEM_EV_FREE, mpid, block, block->size, log_two_floor(block->size));
+    k_buddy_free(pool, block);
+    return newPtr;
+}
+
+/**************************************************************************//**
+ * @brief   allocate size bytes at an address that is a multiple of align
+ * @return  user pointer on success, NULL on failure
+ * @param   align   a power of two, below the largest block of the pool
+ * @details The block is over-allocated by align bytes and the payload
+ *          starts at the first address that is a multiple of align past
+ *          the block header, wherever the pool starts. Unless that is the
+ *          usual payload address, a shim header just below the user
+ *          pointer holds its distance from the block, which leads
+ *          k_mpool_dealloc back to the block.
+ *****************************************************************************/
+void *k_mpool_alloc_aligned(mpool_t mpid, size_t size, size_t align)
+{
+#ifdef DEBUG_0
+    printf("k_mpool_alloc_aligned: mpid = %d, size = %d, align = %d\r\n", mpid, size, align);
+#endif /* DEBUG_0 */
+    memory_pool_t* pool = k_mpool_get(mpid);
+    free_memory_block_t* block;
+    free_memory_block_t* shim;
+    U32 addr;
+
+    if (pool == NULL || size == 0) {
+        return NULL;
+    }
+    if (align == 0 || (align & (align - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (align <= ALLOCATED_BLK_META_SIZE) {
+        return k_mpool_alloc(mpid, size);   // every payload is 8B aligned
+    }
+    if (align >= (1U << pool->maxOrder) || size > (1U << pool->maxOrder) - align) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    block = k_buddy_alloc(pool, log_two_ceil(size + align));
+    if (block == NULL) {
+        MEM_TRACE_EVENT(MEM_EV_FAIL, mpid, 0, size, log_two_ceil(size + align));
+        errno = ENOMEM;
+        return NULL;
+    }
+    MEM_TRACE_EVENT(MEM_EV_ALLOC, mpid, block, size, log_two_floor(block->size));
+
+    // at most align bytes into the block, blocks are ALLOCATED_BLK_META_SIZE aligned
+    addr = ((U32)block + ALLOCATED_BLK_META_SIZE + align - 1) & ~(align - 1);
+    if (addr != (U32)block + ALLOCATED_BLK_META_SIZE) {
+        shim = (free_memory_block_t *)(addr - ALLOCATED_BLK_META_SIZE);
+        shim->size = addr - (U32)block;
+        shim->freeFlag = MPOOL_BLK_SHIM;
+        shim->owner = block->owner;
+    }
+    return (void *)addr;
+}
+
+int k_mpool_dump (mpool_t mpid)
+{
+#ifdef DEBUG_0
+    printf("k_mpool_dump: mpid = %d\r\n", mpid);
+#endif /* DEBUG_0 */
+    memory_pool_t* pool = k_mpool_get(mpid);
+    U32 freeBlockCount = 0;
+
+    if (pool == NULL) {
+        return RTX_ERR;
+    }
+
+    for (U8 order = MIN_BLK_SIZE_LOG2; order <= pool->maxOrder; ++order) {
+        free_memory_block_t* currentBlk = pool->freeList[order - MIN_BLK_SIZE_LOG2];
+        while (currentBlk != NULL) {
+            printf("0x%x: 0x%x\r\n", currentBlk, currentBlk->size);
+            currentBlk = currentBlk->next;
+            freeBlockCount++;
+        }
+        // blocks parked by a BUDDY_LAZY pool are free too
+        currentBlk = pool->quickList[order - MIN_BLK_SIZE_LOG2];
+        while (currentBlk != NULL) {
+            printf("0x%x: 0x%x\r\n", currentBlk, currentBlk->size);
+            currentBlk = currentBlk->next;
+            freeBlockCount++;
+        }
+    }
+    printf("%u free memory block(s) found\r\n", freeBlockCount);
+
+    return freeBlockCount;
+}
+
+/**************************************************************************//**
+ * @brief   fill a caller buffer with the statistics of a memory pool
+ * @return  RTX_OK on success, RTX_ERR on failure
+ * @note    O(number of orders), nothing is printed, so it is cheap enough
+ *          to be sampled periodically by a monitoring task
+ *****************************************************************************/
+int k_mpool_stats(mpool_t mpid, MPOOL_STATS *buffer)
+{
+#ifdef DEBUG_0
+    printf("k_mpool_stats: mpid = %d, buffer = 0x%x\r\n", mpid, buffer);
+#endif /* DEBUG_0 */
+    memory_pool_t* pool;
+    U32 totalFree = 0;
+
+    if (buffer == NULL) {
+        errno = EFAULT;
+        return RTX_ERR;
+    }
+    pool = k_mpool_get(mpid);
+    if (pool == NULL) {
+        return RTX_ERR;
+    }
+
+    buffer->largest_free = 0;
+    for (U8 i = 0; i < MPOOL_NUM_ORDERS; i++) {
+        U32 count = pool->freeCount[i] + pool->quickCount[i];
+
+        buffer->free_bytes[i] = count << (i + MIN_BLK_SIZE_LOG2);
+        totalFree += buffer->free_bytes[i];
+        if (count != 0) {
+            buffer->largest_free = 1U << (i + MIN_BLK_SIZE_LOG2);
+        }
+    }
+
+    buffer->total_size   = pool->end - pool->start + 1;
+    buffer->bytes_in_use = pool->inUse;
+    buffer->cached_bytes = pool->cached;
+    buffer->peak_in_use  = pool->peakInUse;
+    buffer->frag_index   = (totalFree == 0) ? 0 : 1000 - (buffer->largest_free * 1000) / totalFree;
+    buffer->num_allocs   = pool->numAllocs;
+    buffer->num_frees    = pool->numFrees;
+    buffer->num_failures = pool->numFailures;
+    buffer->alloc_cycles = pool->allocCycles;
+    return RTX_OK;
+}
+ 
+/*
+ *===========================================================================
+ *                            MEM_ALLOC MAGAZINES
+ *===========================================================================
+ */
+
+/**
+ * @brief   priority band of the calling task, real-time tasks share band 0 with HIGH
+ */
+static U8 k_mem_cache_band(void)
+{
+    U8 prio = (gp_current_task != NULL) ? gp_current_task->prio : LOWEST;
+    U8 band = (prio < HIGH) ? 0 : ((prio > LOWEST) ? LOWEST : prio) - HIGH;
+
+    return (band < g_mem_cache_cfg.bands) ? band : g_mem_cache_cfg.bands - 1;
+}
+
+/**
+ * @brief   take up to count blocks of the given order from the buddy core in one batch
+ * @note    magazine blocks count in cached, not in inUse
+ */
+static void k_mem_cache_refill(mem_magazine_t *mag, U8 order, U8 count)
+{
+    memory_pool_t* pool = &g_mpools[MPID_IRAM1];
+
+    while (mag->count < count) {
+        free_memory_block_t* block = k_buddy_take(pool, order);
+
+        if (block == NULL) {
+            break;
+        }
+        pool->cached += block->size;
+        MEM_TRACE_EVENT(MEM_EV_CACHE_FILL, MPID_IRAM1, block, block->size, order);
+        block->freeFlag = MPOOL_BLK_CACHED;
+        block->next = mag->head;
+        mag->head = block;
+        mag->count++;
+    }
+}
+
+/**
+ * @brief   hand blocks back to the buddy core in one batch until count are left
+ * @return  number of blocks handed back
+ */
+static U32 k_mem_cache_drain(mem_magazine_t *mag, U8 count)
+{
+    memory_pool_t* pool = &g_mpools[MPID_IRAM1];
+    U32 drained = 0;
+
+    while (mag->count > count) {
+        free_memory_block_t* block = mag->head;
+
+        mag->head = block->next;
+        mag->count--;
+        pool->cached -= block->size;
+        MEM_TRACE_EVENT(MEM_EV_CACHE_DRAIN, MPID_IRAM1, block, block->size, log_two_floor(block->size));
+        block->freeFlag = 0;
+        k_buddy_put(pool, block);
+        drained++;
+    }
+    return drained;
+}
+
+/**
+ * @brief   hand every magazine back to the buddy core
+ * @return  number of blocks handed back
+ * @note    called by k_buddy_alloc before a MPID_IRAM1 allocation fails,
+ *          the magazines refill on their next miss
+ */
+static U32 k_mem_cache_flush(void)
+{
+    U32 count = 0;
+
+    for (U8 b = 0; b < g_mem_cache_cfg.bands; b++) {
+        for (U8 i = 0; i < MEM_CACHE_ORDERS; i++) {
+            count += k_mem_cache_drain(&g_mem_cache[b][i], 0);
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief   serve a mem_alloc from the magazine of the calling task's band
+ * @return  user pointer, NULL if the order is not cached or MPID_IRAM1
+ *          cannot refill the magazine
+ * @details A hit is a list pop, no split runs. An empty magazine is
+ *          refilled with low blocks (at least one) in one batch.
+ */
+static void *k_mem_cache_alloc(size_t size)
+{
+    U32 startCycles = K_CYCLES();
+    memory_pool_t* pool = &g_mpools[MPID_IRAM1];
+    U8 order = k_mpool_order(size);
+    U8 i = order - MIN_BLK_SIZE_LOG2;
+    mem_magazine_t *mag;
+    free_memory_block_t* block;
+
+    if (order > MEM_CACHE_MAX_ORDER || g_mem_cache_cfg.high[i] == 0) {
+        return NULL;
+    }
+    mag = &g_mem_cache[k_mem_cache_band()][i];
+    if (mag->count == 0) {
+        k_mem_cache_refill(mag, order, (g_mem_cache_cfg.low[i] != 0) ? g_mem_cache_cfg.low[i] : 1);
+        if (mag->count == 0) {
+            return NULL;
+        }
+    }
+
+    block = mag->head;
+    mag->head = block->next;
+    mag->count--;
+    block->freeFlag = 0;
+    block->owner = k_mpool_owner();
+
+    pool->cached -= block->size;
+    pool->inUse += block->size;
+    if (pool->inUse > pool->peakInUse) {
+        pool->peakInUse = pool->inUse;
+    }
+    pool->numAllocs++;
+    pool->allocCycles += K_CYCLES() - startCycles;
+    MEM_TRACE_EVENT(MEM_EV_ALLOC | MEM_EV_CACHED, MPID_IRAM1, block, size, order);
+    return (void *)((char *)block + ALLOCATED_BLK_META_SIZE);
+}
+
+/**
+ * @brief   return a MPID_IRAM1 block to the magazine of the calling task's band
+ * @return  RTX_OK if the magazine took the block, RTX_ERR if ptr is not a
+ *          live MPID_IRAM1 block of a cached order
+ * @details A magazine that grows past high is drained back to low in one
+ *          batch, so the merges are paid once per high - low frees.
+ */
+static int k_mem_cache_free(void *ptr)
+{
+    free_memory_block_t* block = k_mpool_block_of(&g_mpools[MPID_IRAM1], ptr);
+    mem_magazine_t *mag;
+    U8 order;
+
+    if (block == NULL) {
+        return RTX_ERR;
+    }
+    order = log_two_floor(block->size);
+    if (order > MEM_CACHE_MAX_ORDER || g_mem_cache_cfg.high[order - MIN_BLK_SIZE_LOG2] == 0) {
+        return RTX_ERR;
+    }
+
+    MEM_TRACE_EVENT(MEM_EV_FREE | MEM_EV_CACHED, MPID_IRAM1, block, block->size, order);
+    mag = &g_mem_cache[k_mem_cache_band()][order - MIN_BLK_SIZE_LOG2];
+    g_mpools[MPID_IRAM1].inUse -= block->size;
+    g_mpools[MPID_IRAM1].numFrees++;
+    g_mpools[MPID_IRAM1].cached += block->size;
+    block->freeFlag = MPOOL_BLK_CACHED;
+    block->next = mag->head;
+    mag->head = block;
+    if (++mag->count > g_mem_cache_cfg.high[order - MIN_BLK_SIZE_LOG2]) {
+        k_mem_cache_drain(mag, g_mem_cache_cfg.low[order - MIN_BLK_SIZE_LOG2]);
+    }
+    return RTX_OK;
+}
+
+/**
+ * @brief   check and install the magazine watermarks, then fill every magazine to low
+ * @return  RTX_OK on success, RTX_ERR with errno set to EINVAL on a bad configuration
+ */
+static int k_mem_cache_init(const MEM_CACHE_CFG *cache)
+{
+    for (U8 b = 0; b < MEM_CACHE_BANDS; b++) {
+        for (U8 i = 0; i < MEM_CACHE_ORDERS; i++) {
+            g_mem_cache[b][i].head = NULL;
+            g_mem_cache[b][i].count = 0;
+        }
+    }
+    for (U8 i = 0; i < MEM_CACHE_ORDERS; i++) {
+        g_mem_cache_cfg.low[i] = 0;
+        g_mem_cache_cfg.high[i] = 0;
+    }
+    g_mem_cache_cfg.bands = 1;
+
+    if (cache == NULL) {
+        return RTX_OK;
+    }
+    if (cache->bands > MEM_CACHE_BANDS) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    for (U8 i = 0; i < MEM_CACHE_ORDERS; i++) {
+        if (cache->high[i] > MEM_CACHE_DEPTH || cache->low[i] > cache->high[i]) {
+            errno = EINVAL;
+            return RTX_ERR;
+        }
+    }
+    g_mem_cache_cfg = *cache;
+    if (g_mem_cache_cfg.bands == 0) {
+        g_mem_cache_cfg.bands = 1;
+    }
+
+    for (U8 b = 0; b < g_mem_cache_cfg.bands; b++) {
+        for (U8 i = 0; i < MEM_CACHE_ORDERS; i++) {
+            k_mem_cache_refill(&g_mem_cache[b][i], i + MIN_BLK_SIZE_LOG2, g_mem_cache_cfg.low[i]);
+        }
+    }
+    return RTX_OK;
+}
+
+/**
+ * @param   cache   mem_alloc magazine watermarks, NULL to leave mem_alloc uncached
+ */
+int k_mem_init(int algo, const MEM_CACHE_CFG *cache)
+{
+#ifdef DEBUG_0
+    printf("k_mem_init: algo = %d\r\n", algo);
+#endif /* DEBUG_0 */
+
+    // start the cycle counter used for allocation latency statistics
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    for (mpool_t mpid = 0; mpid < NUM_MPOOLS; mpid++) {
+        g_mpools[mpid].active = 0;
+    }
+        
+    if ( k_mpool_create(algo, RAM1_START, RAM1_END) < 0 ) {
+        return RTX_ERR;
+    }
+    
+    if ( k_mpool_create(algo, RAM2_START, RAM2_END) < 0 ) {
+        return RTX_ERR;
+    }
+
+    for (U8 i = 0; i < ISR_STASH_ORDERS; i++) {
+        g_isr_stash[i] = NULL;
+        g_isr_stash_count[i] = 0;
+    }
+    g_isr_deferred = NULL;
+    k_mem_isr_refill();
+
+    for (hmem_t h = 0; h < HMEM_NUM_HANDLES; h++) {
+        g_hmem[h].ptr = NULL;
+        g_hmem[h].locks = 0;
+        g_hmem[h].owner = TID_UNK;
+    }
+    
+    return k_mem_cache_init(cache);
+}
+
+/**************************************************************************//**
+ * @brief   allocate from the heap of the calling task
+ * @note    serves SVC_MEM_ALLOC. Tasks in arena mode allocate from their
+ *          private arena, all other tasks from MPID_IRAM1, through the
+ *          magazine of their priority band when the order is cached.
+ *****************************************************************************/
+void *k_mem_alloc(size_t size)
+{
+    mpool_t mpid = (gp_current_task != NULL) ? gp_current_task->heap : MPID_IRAM1;
+
+    if (mpid == MPID_IRAM1 && size != 0) {
+        void *ptr = k_mem_cache_alloc(size);
+
+        if (ptr != NULL) {
+            return ptr;
+        }
+    }
+    return k_mpool_alloc(mpid, size);
+}
+
+/**
+ * @brief   pool of the calling task's heap that ptr belongs to
+ * @note    a task in arena mode may still hold IRAM1 blocks it got
+ *          before its arena was created
+ */
+static mpool_t k_mem_heap_of(void *ptr)
+{
+    mpool_t mpid = (gp_current_task != NULL) ? gp_current_task->heap : MPID_IRAM1;
+
+    if (mpid != MPID_IRAM1 &&
+        ((U32)ptr < g_mpools[mpid].start || (U32)ptr > g_mpools[mpid].end)) {
+        mpid = MPID_IRAM1;
+    }
+    return mpid;
+}
+
+/**
+ * @brief   check whether ptr is the block of a live movable handle
+ * @note    such a block is only released through hmem_free
+ */
+static int k_hmem_held(void *ptr)
+{
+    for (hmem_t h = 0; h < HMEM_NUM_HANDLES; h++) {
+        if (g_hmem[h].owner != TID_UNK && g_hmem[h].ptr == ptr) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief   check that the calling task owns the k_mem_alloc block at ptr
+ * @return  RTX_OK if it does or ptr is no allocated block of the pool,
+ *          RTX_ERR with errno EPERM if another task owns it
+ * @note    the owner sits in the block header, an aligned allocation is
+ *          found through its shim. Blocks from k_mem_isr_alloc are owned
+ *          by TID_UNK and any task may release them.
+ */
+static int k_mem_owner_check(mpool_t mpid, void *ptr)
+{
+    free_memory_block_t* block = k_mpool_block_of(&g_mpools[mpid], ptr);
+
+    if (block != NULL && block->owner != TID_UNK && block->owner != k_mpool_owner()) {
+        errno = EPERM;
+        return RTX_ERR;
+    }
+    return RTX_OK;
+}
+
+/**
+ * @brief   free a block obtained through k_mem_alloc
+ * @note    only the owner may, see k_mem_give
+ */
+int k_mem_dealloc(void *ptr)
+{
+    mpool_t mpid = k_mem_heap_of(ptr);
+
+    if (ptr != NULL && k_hmem_held(ptr)) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    if (k_mem_owner_check(mpid, ptr) != RTX_OK) {
+        return RTX_ERR;
+    }
+    if (mpid == MPID_IRAM1 && ptr != NULL && k_mem_cache_free(ptr) == RTX_OK) {
+        return RTX_OK;
+    }
+    return k_mpool_dealloc(mpid, ptr);
+}
+
+/**************************************************************************//**
+ * @brief   hand a k_mem_alloc block of the calling task over to task tid
+ * @return  RTX_OK on success, RTX_ERR on failure
+ * @details Only MPID_IRAM1 blocks qualify. An arena block would vanish with
+ *          the arena of the sender, and the compactor may move a movable
+ *          block under the receiver. After the call only tid may give the
+ *          block on, and it frees the block with mem_dealloc.
+ *****************************************************************************/
+int k_mem_give(void *ptr, task_t tid)
+{
+    free_memory_block_t* block;
+    free_memory_block_t* shim;
+
+    if (k_mem_heap_of(ptr) != MPID_IRAM1) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    block = k_mpool_block_of(&g_mpools[MPID_IRAM1], ptr);
+    if (block == NULL) {
+        errno = EFAULT;
+        return RTX_ERR;
+    }
+    if (block->owner != k_mpool_owner()) {
+        errno = EPERM;
+        return RTX_ERR;
+    }
+    if (k_hmem_held(ptr)) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+
+    block->owner = tid;
+    shim = (free_memory_block_t *)((U32)ptr - ALLOCATED_BLK_META_SIZE);
+    if (shim->freeFlag == MPOOL_BLK_SHIM) {
+        shim->owner = tid;
+    }
+    return RTX_OK;
+}
+
+/**
+ * @brief   resize a block obtained through k_mem_alloc
+ * @note    serves SVC_MEM_REALLOC, the block stays in the pool it came from
+ *          and only its owner may resize it
+ */
+void *k_mem_realloc(void *ptr, size_t size)
+{
+    mpool_t mpid = k_mem_heap_of(ptr);
+
+    if (ptr != NULL && k_hmem_held(ptr)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (k_mem_owner_check(mpid, ptr) != RTX_OK) {
+        return NULL;
+    }
+    return k_mpool_realloc(mpid, ptr, size);
+}
+
+/**
+ * @brief   aligned allocation from the heap of the calling task
+ * @note    serves SVC_MEM_ALLOC_ALIGNED, the result is freed with k_mem_dealloc
+ */
+void *k_mem_alloc_aligned(size_t size, size_t align)
+{
+    mpool_t mpid = (gp_current_task != NULL) ? gp_current_task->heap : MPID_IRAM1;
+
+    return k_mpool_alloc_aligned(mpid, size, align);
+}
+
+/**************************************************************************//**
+ * @brief   switch the calling task to arena mode
+ * @return  RTX_OK on success, RTX_ERR on failure
+ * @param   size    arena size in bytes, rounded up to a power of two
+ * @details The arena is carved out of MPID_IRAM1 as a single buddy block.
+ *          All later mem_alloc calls of the task are served from it, and
+ *          the whole arena goes back to MPID_IRAM1 in one free when the
+ *          task exits, whether or not the task freed its blocks.
+ *****************************************************************************/
+int k_mem_arena_create(size_t size)
+{
+#ifdef DEBUG_0
+    printf("k_mem_arena_create: size = %d\r\n", size);
+#endif /* DEBUG_0 */
+    mpool_t mpid;
+
+    if (gp_current_task->heap != MPID_IRAM1) {
+        errno = EEXIST;
+        return RTX_ERR;
+    }
+
+    mpid = k_mpool_create_sub(MPID_IRAM1, g_mpools[MPID_IRAM1].algo, size);
+    if (mpid == RTX_ERR) {
+        return RTX_ERR;
+    }
+
+    gp_current_task->heap = mpid;
+    return RTX_OK;
+}
+
+/**
+ * @brief   release the arena of a task, called on task exit
+ */
+int k_mem_arena_release(task_t tid)
+{
+    mpool_t mpid = g_tcbs[tid].heap;
+
+    if (mpid == MPID_IRAM1) {
+        return RTX_OK;
+    }
+    g_tcbs[tid].heap = MPID_IRAM1;
+    return k_mpool_destroy(mpid);
+}
+
+/**
+ * @brief   check that mpid names a pool the caller created through mpool_create
+ * @return  RTX_OK if it does, RTX_ERR with errno set otherwise
+ */
+static int k_mpool_user_check(mpool_t mpid)
+{
+    if (k_mpool_get(mpid) == NULL) {
+        return RTX_ERR;
+    }
+    // system pools and task arenas are not reachable through the mpool_* calls
+    if (mpid < MAX_MPOOLS || g_mpools[mpid].parent != MPID_IRAM2) {
+        errno = EPERM;
+        return RTX_ERR;
+    }
+    // a pool is private to the task that created it
+    if (g_mpools[mpid].owner != k_mpool_owner()) {
+        errno = EPERM;
+        return RTX_ERR;
+    }
+    return RTX_OK;
+}
+
+/**************************************************************************//**
+ * @brief   create an application memory pool carved out of MPID_IRAM2
+ * @return  the new pool id on success, RTX_ERR on failure
+ * @param   algo    allocator algorithm, BUDDY or BUDDY_LAZY
+ * @param   size    pool size in bytes, rounded up to a power of two
+ * @details Each subsystem can own an isolated pool, so bursty allocations
+ *          in one cannot fragment or exhaust the heap of another.
+ *          The pool competes with task stacks for IRAM2 space.
+ *          Only the creating task may allocate from or free into it.
+ *          Pools are never destroyed: the IRAM2 block and the pool slot
+ *          stay taken for the life of the system, even after the creator
+ *          exits.
+ *****************************************************************************/
+mpool_t k_mpool_user_create(int algo, size_t size)
+{
+#ifdef DEBUG_0
+    printf("k_mpool_user_create: algo = %d, size = %d\r\n", algo, size);
+#endif /* DEBUG_0 */
+    return k_mpool_create_sub(MPID_IRAM2, algo, size);
+}
+
+void *k_mpool_user_alloc(mpool_t mpid, size_t size)
+{
+#ifdef DEBUG_0
+    printf("k_mpool_user_alloc: mpid = %d, size = %d\r\n", mpid, size);
+#endif /* DEBUG_0 */
+    if (k_mpool_user_check(mpid) != RTX_OK) {
+        return NULL;
+    }
+    return k_mpool_alloc(mpid, size);
+}
+
+int k_mpool_user_free(mpool_t mpid, void *ptr)
+{
+#ifdef DEBUG_0
+    printf("k_mpool_user_free: mpid = %d, ptr = 0x%x\r\n", mpid, ptr);
+#endif /* DEBUG_0 */
+    if (k_mpool_user_check(mpid) != RTX_OK) {
+        return RTX_ERR;
+    }
+    return k_mpool_dealloc(mpid, ptr);
+}
+
+/*
+ *===========================================================================
+ *                            MOVABLE ALLOCATIONS
+ *===========================================================================
+ */
+
+/**
+ * @brief   look up a handle in use
+ * @return  handle entry, NULL with errno set to EINVAL if h is not in use
+ */
+static hmem_entry_t* k_hmem_get(hmem_t h)
+{
+    if (h < 0 || h >= HMEM_NUM_HANDLES || g_hmem[h].owner == TID_UNK) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return &g_hmem[h];
+}
+
+/**************************************************************************//**
+ * @brief   allocate a movable block from MPID_IRAM1
+ * @return  handle on success, RTX_ERR on failure
+ * @details The block is only reachable through hmem_lock, which pins it
+ *          and returns its current address. While the block is unlocked
+ *          the compactor may move it, so pointers from an earlier lock
+ *          must not be kept across hmem_unlock.
+ *****************************************************************************/
+hmem_t k_hmem_alloc(size_t size)
+{
+#ifdef DEBUG_0
+    printf("k_hmem_alloc: size = %d\r\n", size);
+#endif /* DEBUG_0 */
+    for (hmem_t h = 0; h < HMEM_NUM_HANDLES; h++) {
+        if (g_hmem[h].owner == TID_UNK) {
+            void *ptr = k_mpool_alloc(MPID_IRAM1, size);
+
+            if (ptr == NULL) {
+                return RTX_ERR;
+            }
+            g_hmem[h].ptr = ptr;
+            g_hmem[h].locks = 0;
+            g_hmem[h].owner = k_mpool_owner();
+            return h;
+        }
+    }
+    errno = ENOMEM;
+    return RTX_ERR;
+}
+
+/**
+ * @brief   free a movable block, only its allocating task may
+ */
+int k_hmem_free(hmem_t h)
+{
+    hmem_entry_t* entry = k_hmem_get(h);
+
+    if (entry == NULL) {
+        return RTX_ERR;
+    }
+    if (entry->owner != k_mpool_owner()) {
+        errno = EPERM;
+        return RTX_ERR;
+    }
+    entry->owner = TID_UNK;
+    return k_mpool_dealloc(MPID_IRAM1, entry->ptr);
+}
+
+/**
+ * @brief   pin a movable block and return its address
+ * @note    locks nest, the block moves again after as many hmem_unlock calls
+ */
+void *k_hmem_lock(hmem_t h)
+{
+    hmem_entry_t* entry = k_hmem_get(h);
+
+    if (entry == NULL) {
+        return NULL;
+    }
+    if (entry->locks == 0xFF) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    entry->locks++;
+    return entry->ptr;
+}
+
+int k_hmem_unlock(hmem_t h)
+{
+    hmem_entry_t* entry = k_hmem_get(h);
+
+    if (entry == NULL) {
+        return RTX_ERR;
+    }
+    if (entry->locks == 0) {
+        errno = EPERM;
+        return RTX_ERR;
+    }
+    entry->locks--;
+    return RTX_OK;
+}
+
+/**************************************************************************//**
+ * @brief   one incremental compaction step of MPID_IRAM1
+ * @return  1 if a block was moved, 0 if no move would help
+ * @details Looks for an unlocked movable block whose buddy is free and a
+ *          free block of the same order whose buddy is in use. Moving the
+ *          block there frees the pair, which merges into a larger block,
+ *          without breaking up another free pair. Smaller orders are tried
+ *          first. A step moves at most one block, so called in a loop from
+ *          the null task it never holds off a ready task for longer than
+ *          one block copy. In a BUDDY_LAZY pool only the quick list of an
+ *          order that holds an unlocked movable block is merged back, so
+ *          a pool without such blocks keeps its parked blocks.
+ *****************************************************************************/
+int k_hmem_compact(void)
+{
+    memory_pool_t* pool = &g_mpools[MPID_IRAM1];
+
+    for (U8 order = MIN_BLK_SIZE_LOG2; order < pool->maxOrder; order++) {
+        U8 flushed = 0;
+
+        for (hmem_t h = 0; h < HMEM_NUM_HANDLES; h++) {
+            hmem_entry_t* entry = &g_hmem[h];
+            free_memory_block_t* block;
+            free_memory_block_t* buddy;
+            free_memory_block_t* target;
+
+            if (entry->owner == TID_UNK || entry->locks != 0) {
+                continue;
+            }
+            block = (free_memory_block_t *)((char *)entry->ptr - ALLOCATED_BLK_META_SIZE);
+            if (block->size != (1U << order)) {
+                continue;
+            }
+            // parked blocks are not free to their buddies
+            if (!flushed && pool->algo == BUDDY_LAZY) {
+                k_lazy_flush_order(pool, order - MIN_BLK_SIZE_LOG2);
+                flushed = 1;
+            }
+            buddy = k_buddy_of(pool, block, order);
+            if (buddy == NULL) {
+                continue;
+            }
+            target = pool->freeList[order - MIN_BLK_SIZE_LOG2];
+            while (target != NULL && (target == buddy || k_buddy_of(pool, target, order) != NULL)) {
+                target = target->next;
+            }
+            if (target == NULL) {
+                continue;
+            }
+
+            k_mpool_remove(pool, target, order);
+            target->size = block->size;
+            target->freeFlag = 0;
+            target->owner = block->owner;
+            k_mem_copy((char *)target + ALLOCATED_BLK_META_SIZE,
+                       (char *)block + ALLOCATED_BLK_META_SIZE, block->size - ALLOCATED_BLK_META_SIZE);
+            entry->ptr = (char *)target + ALLOCATED_BLK_META_SIZE;
+            MEM_TRACE_EVENT(MEM_EV_FREE, MPID_IRAM1, block, block->size, order);
+            MEM_TRACE_EVENT(MEM_EV_ALLOC, MPID_IRAM1, target, target->size, order);
+            k_buddy_merge(pool, block);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief   free the movable blocks of a task, called on task exit
+ */
+void k_hmem_release(task_t tid)
+{
+    for (hmem_t h = 0; h < HMEM_NUM_HANDLES; h++) {
+        if (g_hmem[h].owner == tid) {
+            g_hmem[h].owner = TID_UNK;
+            k_mpool_dealloc(MPID_IRAM1, g_hmem[h].ptr);
+        }
+    }
+}
+
+/**************************************************************************//**
+ * @brief   allocate a buffer from an interrupt handler
+ * @return  user pointer on success, NULL if the stash of every order that
+ *          could hold size bytes is empty
+ * @details Blocks come from per-order stashes of MPID_IRAM1 blocks filled
+ *          in task context, so no split or merge runs inside the handler.
+ *          IRQs are masked only around the list pop. A stash that drops
+ *          below ISR_STASH_LOW is topped up at the end of the next SVC.
+ *          The result is an ordinary MPID_IRAM1 block, a task that gets
+ *          it from the handler releases it with mem_dealloc.
+ *****************************************************************************/
+void *k_mem_isr_alloc(size_t size)
+{
+    free_memory_block_t* block = NULL;
+    U32 primask;
+    U8 order = k_mpool_order(size);
+
+    if (size == 0 || order > ISR_STASH_MAX_ORDER) {
+        return NULL;
+    }
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    // fall back to a larger block rather than fail in the handler
+    for (U8 i = order - MIN_BLK_SIZE_LOG2; i < ISR_STASH_ORDERS && block == NULL; i++) {
+        block = g_isr_stash[i];
+        if (block != NULL) {
+            g_isr_stash[i] = block->next;
+            block->freeFlag = 0;
+            block->owner = TID_UNK;     // whichever task receives it frees it
+            if (--g_isr_stash_count[i] < ISR_STASH_LOW) {
+                g_isr_refill = 1;
+            }
+        }
+    }
+    __set_PRIMASK(primask);
+
+    if (block == NULL) {
+        g_isr_refill = 1;
+        return NULL;
+    }
+    return (void *)((char *)block + ALLOCATED_BLK_META_SIZE);
+}
+
+/**
+ * @brief   free a MPID_IRAM1 block from an interrupt handler
+ * @note    a full stash defers the free to k_mem_isr_refill. Blocks of an
+ *          arena or behind a movable handle are refused, the handler may
+ *          interrupt any task so the arena of every task is checked.
+ */
+int k_mem_isr_free(void *ptr)
+{
+    free_memory_block_t* block;
+    U32 primask;
+    U8 i;
+
+    for (mpool_t mpid = MAX_MPOOLS; mpid < NUM_MPOOLS; mpid++) {
+        if (g_mpools[mpid].active && g_mpools[mpid].parent == MPID_IRAM1 &&
+            (U32)ptr >= g_mpools[mpid].start && (U32)ptr <= g_mpools[mpid].end) {
+            return RTX_ERR;
+        }
+    }
+    if (k_hmem_held(ptr)) {
+        return RTX_ERR;
+    }
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    // a stashed or deferred block is MPOOL_BLK_ISR, so a second free fails here
+    block = k_mpool_block_of(&g_mpools[MPID_IRAM1], ptr);
+    if (block == NULL) {
+        __set_PRIMASK(primask);
+        return RTX_ERR;
+    }
+    block->freeFlag = MPOOL_BLK_ISR;
+    i = log_two_floor(block->size) - MIN_BLK_SIZE_LOG2;
+    if (i < ISR_STASH_ORDERS && g_isr_stash_count[i] < ISR_STASH_HIGH) {
+        block->next = g_isr_stash[i];
+        g_isr_stash[i] = block;
+        g_isr_stash_count[i]++;
+    } else {
+        block->next = g_isr_deferred;
+        g_isr_deferred = block;
+        g_isr_refill = 1;
+    }
+    __set_PRIMASK(primask);
+    return RTX_OK;
+}
+
+/**
+ * @brief   top up the ISR stashes from MPID_IRAM1 and release deferred frees
+ * @note    task context only, called by k_mem_init and at the end of an SVC
+ *          when g_isr_refill is set
+ */
+void k_mem_isr_refill(void)
+{
+    free_memory_block_t* block;
+    U32 primask;
+
+    g_isr_refill = 0;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    block = g_isr_deferred;
+    g_isr_deferred = NULL;
+    __set_PRIMASK(primask);
+
+    while (block != NULL) {
+        free_memory_block_t* next = block->next;
+
+        block->freeFlag = 0;
+        k_mpool_dealloc(MPID_IRAM1, (char *)block + ALLOCATED_BLK_META_SIZE);
+        block = next;
+    }
+
+    for (U8 i = 0; i < ISR_STASH_ORDERS; i++) {
+        while (g_isr_stash_count[i] < ISR_STASH_HIGH) {
+            void *ptr = k_mpool_alloc(MPID_IRAM1, (1U << (i + MIN_BLK_SIZE_LOG2)) - ALLOCATED_BLK_META_SIZE);
+
+            if (ptr == NULL) {
+                break;
+            }
+            block = (free_memory_block_t *)((char *)ptr - ALLOCATED_BLK_META_SIZE);
+            block->freeFlag = MPOOL_BLK_ISR;
+            primask = __get_PRIMASK();
+            __disable_irq();
+            block->next = g_isr_stash[i];
+            g_isr_stash[i] = block;
+            g_isr_stash_count[i]++;
+            __set_PRIMASK(primask);
+        }
+    }
+}
+
+/**
+ * @brief   fill a stack with STACK_PAINT so its high-water mark can be found later
+ */
+static void k_paint_stack(U32 *low, U32 size)
+{
+    for (U32 i = 0; i < (size >> 2); i++) {
+        low[i] = STACK_PAINT;
+    }
+}
+
+/**
+ * @brief   deepest use of a painted stack
+ * @return  number of bytes from the stack base down to the lowest word
+ *          that no longer holds STACK_PAINT
+ */
+U32 k_stack_used(U32 *low, U32 size)
+{
+    U32 i = 0;
+
+    while (i < (size >> 2) && low[i] == STACK_PAINT) {
+        i++;
+    }
+    return size - (i << 2);
+}
+
+/**
+ * @brief allocate kernel stack statically
+ * @note  with K_SHARED_STACK every tid gets the one shared stack, it is
+ *        only painted while no SVC runs on it, see k_tsk_init
+ */
+U32* k_alloc_k_stack(task_t tid)
+{
+    
+    if ( tid >= MAX_TASKS) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    k_paint_stack(K_STACK_OF(tid), KERN_STACK_SIZE);
+
+    U32 *sp = K_STACK_OF(tid) + (KERN_STACK_SIZE >> 2);
+    
+    // 8B stack alignment adjustment
+    if ((U32)sp & 0x04) {   // if sp not 8B aligned, then it must be 4B aligned
+        sp--;               // adjust it to 8B aligned
+    }
+    return sp;
+}
+
+/**
+ * @brief   allocate the user/process stack of a task from MPID_IRAM2
+ * @return  the stack base (high address), NULL on failure
+ * @note    the stack size is taken from g_tcbs[tid].stackSize, at least
+ *          PROC_STACK_SIZE. Calling it again before k_free_p_stack returns
+ *          the same stack, k_pre_rtx_init relies on this for the null task.
+ *          The block is laid out as
+ *          [header granule][guard granule][stackSize usable bytes],
+ *          each granule STACK_GUARD_SIZE bytes, so the guard never eats
+ *          into the requested stack.
+ */
+U32* k_alloc_p_stack(task_t tid)
+{
+    TCB *p_tcb;
+    U32 *low;
+
+    if ( tid >= MAX_TASKS ) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    
+    p_tcb = &g_tcbs[tid];
+    if (p_tcb->pspBase != NULL) {
+        return p_tcb->pspBase;
+    }
+    if (p_tcb->stackSize < PROC_STACK_SIZE) {
+        p_tcb->stackSize = PROC_STACK_SIZE;
+    }
+    p_tcb->stackSize = (p_tcb->stackSize + 7) & ~0x07;     // 8B stack alignment
+    
+    low = k_mpool_alloc(MPID_IRAM2, p_tcb->stackSize + (STACK_GUARD_SIZE << 1) - ALLOCATED_BLK_META_SIZE);
+    if (low == NULL) {
+        return NULL;
+    }
+    low += ((STACK_GUARD_SIZE << 1) - ALLOCATED_BLK_META_SIZE) >> 2;
+    k_paint_stack(low, p_tcb->stackSize);
+
+    p_tcb->pspBase = low + (p_tcb->stackSize >> 2);
+    return p_tcb->pspBase;
+}
+
+/**
+ * @brief   lowest address of the MPU guard region of a task's user stack
+ * @note    the stack block is aligned to its own size inside MPID_IRAM2, so
+ *          the guard granule right below the usable stack is aligned as the
+ *          MPU requires. The granule below the guard keeps the block header
+ *          readable by the allocator, see k_alloc_p_stack.
+ */
+U32* k_u_stack_guard(TCB *p_tcb)
+{
+    return p_tcb->pspBase - ((p_tcb->stackSize + STACK_GUARD_SIZE) >> 2);
+}
+
+/**
+ * @brief   return the user stack of a task to MPID_IRAM2
+ */
+int k_free_p_stack(task_t tid)
+{
+    TCB *p_tcb = &g_tcbs[tid];
+    int ret;
+
+    if (p_tcb->pspBase == NULL) {
+        return RTX_OK;
+    }
+    ret = k_mpool_dealloc(MPID_IRAM2, (U8 *)k_u_stack_guard(p_tcb) - STACK_GUARD_SIZE + ALLOCATED_BLK_META_SIZE);
+    p_tcb->pspBase = NULL;
+    return ret;
 }
 
 /*
@@ -38,11 +38,42 @@ mpool_t k_mpool_create  (int algo, U32 strat, U32 end);
 void   *k_mpool_alloc   (mpool_t mpid, size_t size);
 int     k_mpool_dealloc (mpool_t mpid, void *ptr);
 int     k_mpool_dump    (mpool_t mpid);
+int     k_mpool_stats   (mpool_t mpid, MPOOL_STATS *buffer);
 
-int     k_mem_init      (int algo);
+int     k_mem_init      (int algo, const MEM_CACHE_CFG *cache);
 U32    *k_alloc_k_stack (task_t tid);
 U32    *k_alloc_p_stack (task_t tid);
+int     k_free_p_stack  (task_t tid);
+U32     k_stack_used    (U32 *low, U32 size);
+U32    *k_u_stack_guard (TCB *p_tcb);
 // declare newly added functions here
+mpool_t k_mpool_create_sub  (mpool_t parent, int algo, size_t size);
+int     k_mpool_destroy     (mpool_t mpid);
+void   *k_mpool_realloc     (mpool_t mpid, void *ptr, size_t size);
+void   *k_mpool_alloc_aligned (mpool_t mpid, size_t size, size_t align);
+#ifdef MEM_TRACE
+int     k_mem_trace_dump    (void);
+#endif
+void   *k_mem_alloc         (size_t size);
+int     k_mem_dealloc       (void *ptr);
+void   *k_mem_realloc       (void *ptr, size_t size);
+void   *k_mem_alloc_aligned (size_t size, size_t align);
+void   *k_mem_isr_alloc     (size_t size);
+int     k_mem_isr_free      (void *ptr);
+void    k_mem_isr_refill    (void);
+int     k_mem_arena_create  (size_t size);
+int     k_mem_arena_release (task_t tid);
+hmem_t  k_hmem_alloc        (size_t size);
+int     k_hmem_free         (hmem_t h);
+void   *k_hmem_lock         (hmem_t h);
+int     k_hmem_unlock       (hmem_t h);
+int     k_hmem_compact      (void);
+void    k_hmem_release      (task_t tid);
+mpool_t k_mpool_user_create (int algo, size_t size);
+void   *k_mpool_user_alloc  (mpool_t mpid, size_t size);
+int     k_mpool_user_free   (mpool_t mpid, void *ptr);
+void    k_mem_copy          (void *dst, const void *src, U32 size);
+int     k_mem_give          (void *ptr, task_t tid);
 
 
 /*
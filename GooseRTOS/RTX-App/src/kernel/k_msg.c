@@ -36,57 +36,1478 @@
 
 #include "k_inc.h"
 #include "k_rtx.h"
-//#include "k_msg.h"
+#include "helper.h"
 
 
+/*
+ *===========================================================================
+ *                            GLOBAL VARIABLES
+ *===========================================================================
+ */
+
+mailbox_t g_mbx[MAX_TASKS];     // mailbox of each task, buf == NULL if none
+topic_entry_t g_topics[MAX_TOPICS]; // publish/subscribe topics, see k_topic_open
+
+/*
+ *===========================================================================
+ *                            FUNCTIONS
+ *===========================================================================
+ */
+
+/**
+ * @brief   append len bytes at the tail of the ring, wrapping at the end
+ * @pre     len <= mbx->size - mbx->used
+ */
+static void k_mbx_write(mailbox_t *mbx, const void *src, U32 len)
+{
+    U32 tail = mbx->head + mbx->ringUsed;
+    U32 first;
+
+    if (tail >= mbx->size) {
+        tail -= mbx->size;
+    }
+    first = mbx->size - tail;
+    if (first > len) {
+        first = len;
+    }
+    k_mem_copy(mbx->buf + tail, src, first);
+    k_mem_copy(mbx->buf, (const U8 *)src + first, len - first);
+    mbx->used += len;
+    mbx->ringUsed += len;
+}
+
+/**
+ * @brief   copy len bytes at offset off of the ring without consuming them
+ */
+static void k_mbx_peek_at(mailbox_t *mbx, U32 off, void *dst, U32 len)
+{
+    U32 first = mbx->size - off;
+
+    if (first > len) {
+        first = len;
+    }
+    k_mem_copy(dst, mbx->buf + off, first);
+    k_mem_copy((U8 *)dst + first, mbx->buf, len - first);
+}
+
+/**
+ * @brief   copy len bytes from the head of the ring without consuming them
+ */
+static void k_mbx_peek(mailbox_t *mbx, void *dst, U32 len)
+{
+    k_mbx_peek_at(mbx, mbx->head, dst, len);
+}
+
+/**
+ * @brief   ring offset len bytes after off
+ */
+static U32 k_mbx_next_off(mailbox_t *mbx, U32 off, U32 len)
+{
+    off += len;
+    return (off >= mbx->size) ? off - mbx->size : off;
+}
+
+/**
+ * @brief   consume len bytes at the head of the ring, copied to dst unless NULL
+ */
+static void k_mbx_read(mailbox_t *mbx, void *dst, U32 len)
+{
+    if (dst != NULL) {
+        k_mbx_peek(mbx, dst, len);
+    }
+    mbx->head += len;
+    if (mbx->head >= mbx->size) {
+        mbx->head -= mbx->size;
+    }
+    mbx->used -= len;
+    mbx->ringUsed -= len;
+}
+
+/**
+ * @brief   whether a message type is selected by a recv_msg_type type_mask
+ */
+static int k_mbx_type_in(U8 type, U32 type_mask)
+{
+    return type < MBX_NUM_TYPES && (type_mask & (1U << type)) != 0;
+}
+
+/**
+ * @brief   add a message about to be written at the tail of the ring to the type index
+ */
+static void k_mbx_index_add(mailbox_t *mbx, U8 type)
+{
+    if (type >= MBX_NUM_TYPES) {
+        return;
+    }
+    if (mbx->typeCount[type]++ == 0) {
+        mbx->typeFirst[type] = k_mbx_next_off(mbx, mbx->head, mbx->ringUsed);
+        mbx->ringTypes |= 1U << type;
+    }
+}
+
+/**
+ * @brief   count a received message in the latency histogram
+ * @param   cycles  time since it was sent
+ */
+static void k_mbx_latency(mailbox_t *mbx, U32 cycles)
+{
+    U32 bucket = 0;
+
+    if (cycles >> MBX_LAT_BASE_LOG2) {
+        bucket = (log_two_floor(cycles) - MBX_LAT_BASE_LOG2) / 2 + 1;
+        if (bucket >= MBX_LAT_BUCKETS) {
+            bucket = MBX_LAT_BUCKETS - 1;
+        }
+    }
+    mbx->stats.latency[bucket]++;
+}
+
+/**
+ * @brief   time a message about to be written at the tail of the ring
+ * @note    with MBX_STAMP_DEPTH messages timed already it goes untimed
+ */
+static void k_mbx_stamp_add(mailbox_t *mbx)
+{
+    mbx_stats_t *st = &mbx->stats;
+    U8 i;
+
+    if (st->stampCount == MBX_STAMP_DEPTH) {
+        return;
+    }
+    i = (st->stampHead + st->stampCount++) % MBX_STAMP_DEPTH;
+    st->stampOff[i] = k_mbx_next_off(mbx, mbx->head, mbx->ringUsed);
+    st->stampAt[i]  = K_CYCLES();
+}
+
+/**
+ * @brief   drop the stamp of the ring message at off, if it has one
+ * @param   received    count its latency, zero for a dropped message
+ * @note    messages leave the ring oldest first but for recv_msg_type, so
+ *          the stamp is nearly always the oldest one
+ */
+static void k_mbx_stamp_take(mailbox_t *mbx, U32 off, int received)
+{
+    mbx_stats_t *st = &mbx->stats;
+
+    for (U8 n = 0; n < st->stampCount; n++) {
+        U8 i = (st->stampHead + n) % MBX_STAMP_DEPTH;
+
+        if (st->stampOff[i] == off) {
+            if (received) {
+                k_mbx_latency(mbx, K_CYCLES() - st->stampAt[i]);
+            }
+            st->stampOff[i] = MBX_STAMP_NONE;
+            break;
+        }
+    }
+    while (st->stampCount != 0 && st->stampOff[st->stampHead] == MBX_STAMP_NONE) {
+        st->stampHead = (st->stampHead + 1) % MBX_STAMP_DEPTH;
+        st->stampCount--;
+    }
+}
+
+/**
+ * @brief   update the high-water marks after a message was queued
+ */
+static void k_mbx_peak(mailbox_t *mbx)
+{
+    if (mbx->used > mbx->stats.peakUsed) {
+        mbx->stats.peakUsed = mbx->used;
+    }
+    if (mbx->count > mbx->stats.peakCount) {
+        mbx->stats.peakCount = mbx->count;
+    }
+}
+
+/**
+ * @brief   queue a message, the header is stored with the real sender
+ * @return  RTX_OK on success, RTX_ERR with errno ENOSPC if a message above
+ *          MSG_PRIO_NORMAL finds no MPID_IRAM2 memory for its list node.
+ *          Nothing is queued then, it never falls back to the ring where it
+ *          would lose its place.
+ * @pre     msg->length fits in the free space of the mailbox
+ */
+static int k_mbx_enqueue(mailbox_t *mbx, const RTX_MSG_HDR *msg, task_t sender, U8 prio)
+{
+    RTX_MSG_HDR hdr = *msg;
+    mbx_node_t *node;
+
+    hdr.sender_tid = sender;
+    if (prio != MSG_PRIO_NORMAL) {
+        node = k_mpool_alloc(MPID_IRAM2, sizeof(mbx_node_t) - MSG_HDR_SIZE + msg->length);
+        if (node == NULL) {
+            errno = ENOSPC;
+            return RTX_ERR;
+        }
+        node->next  = NULL;
+        node->stamp = K_CYCLES();
+        k_mem_copy(&node->msg, msg, msg->length);
+        node->msg.sender_tid = sender;
+        if (mbx->prioTail[prio] == NULL) {
+            mbx->prioHead[prio] = node;
+            mbx->prioMask |= 1U << prio;
+        } else {
+            mbx->prioTail[prio]->next = node;
+        }
+        mbx->prioTail[prio] = node;
+        mbx->used += msg->length;
+        mbx->count++;
+        k_mbx_peak(mbx);
+        return RTX_OK;
+    }
+    mbx->count++;
+    k_mbx_index_add(mbx, hdr.type);
+    k_mbx_stamp_add(mbx);
+    k_mbx_write(mbx, &hdr, MSG_HDR_SIZE);
+    k_mbx_write(mbx, (const U8 *)msg + MSG_HDR_SIZE, msg->length - MSG_HDR_SIZE);
+    k_mbx_peak(mbx);
+    return RTX_OK;
+}
+
+/**
+ * @brief   highest priority with a message in its list, mbx->prioMask != 0
+ */
+static U8 k_mbx_top_prio(mailbox_t *mbx)
+{
+    return log_two_floor(mbx->prioMask & -mbx->prioMask);  // lowest set bit
+}
+
+/**
+ * @brief   drop the oldest ring message of its type from the type index
+ * @param   off     its offset, typeFirst[hdr->type]
+ * @note    the cursor of the type moves on to the next live message of the
+ *          type. It only ever moves forward, so each message is passed at
+ *          most once per type however the mailbox is drained.
+ */
+static void k_mbx_index_del(mailbox_t *mbx, U32 off, const RTX_MSG_HDR *hdr)
+{
+    RTX_MSG_HDR next;
+    U8 type = hdr->type;
+
+    if (type >= MBX_NUM_TYPES) {
+        return;
+    }
+    if (--mbx->typeCount[type] == 0) {
+        mbx->ringTypes &= ~(1U << type);
+        return;
+    }
+    off = k_mbx_next_off(mbx, off, hdr->length);
+    for (;;) {
+        k_mbx_peek_at(mbx, off, &next, MSG_HDR_SIZE);
+        if (next.type == type && next.sender_tid != MBX_DEAD_TID) {
+            break;
+        }
+        off = k_mbx_next_off(mbx, off, next.length);
+    }
+    mbx->typeFirst[type] = off;
+}
+
+/**
+ * @brief   length of the ring message at off once copied out
+ * @param   ref     set to the shared message of a published record, else NULL
+ */
+static U32 k_mbx_rec_len(mailbox_t *mbx, U32 off, msg_ref_t **ref)
+{
+    mbx_ref_rec_t rec;
+
+    *ref = NULL;
+    k_mbx_peek_at(mbx, off, &rec.hdr, MSG_HDR_SIZE);
+    if (rec.hdr.sender_tid != MBX_REF_TID) {
+        return rec.hdr.length;
+    }
+    k_mbx_peek_at(mbx, off, &rec, sizeof(mbx_ref_rec_t));
+    *ref = rec.ref;
+    return rec.ref->msg.length;
+}
+
+/**
+ * @brief   bytes of a published message of len bytes charged to a mailbox
+ *          beyond its ring record, so it costs the same room as send_msg
+ */
+static U32 k_mbx_ref_extra(U32 len)
+{
+    return (len > sizeof(mbx_ref_rec_t)) ? len - sizeof(mbx_ref_rec_t) : 0;
+}
+
+/**
+ * @brief   copy out the ring message at off, dst may be NULL
+ * @note    the bytes stay in the ring, a published message loses the
+ *          reference, its payload is no longer charged to the mailbox and
+ *          the last mailbox to take it frees it
+ */
+static void k_mbx_rec_copy(mailbox_t *mbx, U32 off, void *dst)
+{
+    msg_ref_t *ref;
+    U32 len = k_mbx_rec_len(mbx, off, &ref);
+
+    if (ref == NULL) {
+        if (dst != NULL) {
+            k_mbx_peek_at(mbx, off, dst, len);
+        }
+        return;
+    }
+    if (dst != NULL) {
+        k_mem_copy(dst, &ref->msg, len);
+    }
+    mbx->used -= k_mbx_ref_extra(len);
+    if (--ref->refs == 0) {
+        k_mpool_dealloc(MPID_IRAM2, ref);
+    }
+}
+
+/**
+ * @brief   free the records at the head of the ring recv_msg_type took
+ */
+static void k_mbx_reclaim(mailbox_t *mbx)
+{
+    RTX_MSG_HDR hdr;
+
+    while (mbx->ringUsed != 0) {
+        k_mbx_peek(mbx, &hdr, MSG_HDR_SIZE);
+        if (hdr.sender_tid != MBX_DEAD_TID) {
+            break;
+        }
+        k_mbx_read(mbx, NULL, hdr.length);
+    }
+}
+
+/**
+ * @brief   length of the next message of a non-empty mailbox once copied out
+ * @param   ref     set to the shared message of a published record, else NULL
+ */
+static U32 k_mbx_front(mailbox_t *mbx, msg_ref_t **ref)
+{
+    if (mbx->prioMask != 0) {
+        *ref = NULL;
+        return mbx->prioHead[k_mbx_top_prio(mbx)]->msg.length;
+    }
+    return k_mbx_rec_len(mbx, mbx->head, ref);
+}
+
+/**
+ * @brief   consume the oldest message of the highest priority, prioMask != 0
+ */
+static void k_mbx_pop_node(mailbox_t *mbx, void *dst)
+{
+    U8 prio = k_mbx_top_prio(mbx);
+    mbx_node_t *node = mbx->prioHead[prio];
+
+    mbx->prioHead[prio] = node->next;
+    if (node->next == NULL) {
+        mbx->prioTail[prio] = NULL;
+        mbx->prioMask &= ~(1U << prio);
+    }
+    if (dst != NULL) {
+        k_mem_copy(dst, &node->msg, node->msg.length);
+        k_mbx_latency(mbx, K_CYCLES() - node->stamp);
+    }
+    mbx->used -= node->msg.length;
+    k_mpool_dealloc(MPID_IRAM2, node);
+}
+
+/**
+ * @brief   consume the next message of a non-empty mailbox
+ * @param   dst     receives the message unless NULL, it must be large enough
+ * @note    the highest priority list comes first, then the ring. The last
+ *          mailbox to take a published message frees it.
+ */
+static void k_mbx_pop(mailbox_t *mbx, void *dst)
+{
+    RTX_MSG_HDR hdr;
+
+    mbx->count--;
+    if (mbx->prioMask != 0) {
+        k_mbx_pop_node(mbx, dst);
+        return;
+    }
+    k_mbx_peek(mbx, &hdr, MSG_HDR_SIZE);
+    k_mbx_index_del(mbx, mbx->head, &hdr);
+    k_mbx_stamp_take(mbx, mbx->head, dst != NULL);
+    k_mbx_rec_copy(mbx, mbx->head, dst);
+    k_mbx_read(mbx, NULL, hdr.length);
+    k_mbx_reclaim(mbx);
+}
+
+/**
+ * @brief   take the next message out of a non-empty mailbox
+ * @return  RTX_OK, or RTX_ERR with errno ENOSPC if it does not fit in len
+ *          bytes, the message is dropped then
+ */
+static int k_mbx_dequeue(mailbox_t *mbx, void *buf, size_t len)
+{
+    msg_ref_t *ref;
+
+    if (k_mbx_front(mbx, &ref) > len) {
+        k_mbx_pop(mbx, NULL);
+        errno = ENOSPC;
+        return RTX_ERR;
+    }
+    k_mbx_pop(mbx, buf);
+    return RTX_OK;
+}
+
+/**
+ * @brief   SVC number of the call a blocked task waits in
+ */
+static U8 k_mbx_wait_svc(TCB *p_tcb)
+{
+    return ((U8 *) p_tcb->svcFrame[6])[-2];    // Memory[(Stacked PC) - 2]
+}
+
+/**
+ * @brief   whether a task is blocked in a copying receive call that takes msg
+ * @note    all of them take buf and len as their first two arguments,
+ *          recv_msg_type its type_mask as the third
+ */
+static int k_mbx_in_recv(TCB *p_tcb, const RTX_MSG_HDR *msg)
+{
+    U8 svc;
+
+    if (p_tcb->state != BLK_RECV) {
+        return 0;
+    }
+    svc = k_mbx_wait_svc(p_tcb);
+    if (svc == SVC_MBX_RECV_TYPE) {
+        return k_mbx_type_in(msg->type, p_tcb->svcFrame[2]);
+    }
+    return svc == SVC_MBX_RECV || svc == SVC_MBX_RECV_TIMEOUT || svc == SVC_MBX_RECV_BATCH;
+}
+
+/**
+ * @brief   copy a message straight into the buffer of a task blocked in recv_msg
+ * @note    the receiver's buf and len are still its stacked SVC arguments.
+ *          A message longer than len is dropped and recv_msg fails with
+ *          ENOSPC, as it does for a queued one.
+ */
+static void k_mbx_handoff(TCB *p_tcb, const RTX_MSG_HDR *msg, task_t sender)
+{
+    RTX_MSG_HDR *dst = (RTX_MSG_HDR *) p_tcb->svcFrame[0];
+
+    if (msg->length > (size_t) p_tcb->svcFrame[1]) {
+        errno = ENOSPC;
+        k_tsk_unblock(p_tcb, RTX_ERR);
+        return;
+    }
+    k_mem_copy(dst, msg, msg->length);
+    dst->sender_tid = sender;
+    k_mbx_latency(&g_mbx[p_tcb->tid], 0);
+    // recv_msg_batch returns the number of messages
+    k_tsk_unblock(p_tcb, (k_mbx_wait_svc(p_tcb) == SVC_MBX_RECV_BATCH) ? 1 : RTX_OK);
+}
+
+/**
+ * @brief   queue the messages of blocked senders while they fit
+ * @return  non-zero if a sender was woken
+ * @note    senders wait in priority order, a waiter that does not fit
+ *          holds back the lower priority ones. A sender's buf is still
+ *          its stacked SVC argument.
+ */
+static int k_mbx_wake_senders(task_t tid)
+{
+    mailbox_t *mbx = &g_mbx[tid];
+    TCB *p_tcb;
+    int woken = 0;
+
+    while ((p_tcb = mbx->senders.head) != NULL) {
+        const RTX_MSG_HDR *msg = (const RTX_MSG_HDR *) p_tcb->svcFrame[1];
+        U8 prio = (k_mbx_wait_svc(p_tcb) == SVC_MBX_SEND_PRIO) ? (U8) p_tcb->svcFrame[2] : MSG_PRIO_NORMAL;
+
+        if (msg->length > mbx->size - mbx->used) {
+            break;      // FIFO, later senders do not overtake
+        }
+        // errno is ENOSPC when a priority message gets no list node
+        k_tsk_unblock(p_tcb, k_mbx_enqueue(mbx, msg, p_tcb->tid, prio));
+        woken = 1;
+    }
+    return woken;
+}
+
+/**
+ * @brief   common checks of every send call
+ * @return  the receiver's mailbox, NULL with errno set on failure
+ */
+static mailbox_t *k_mbx_of_receiver(task_t receiver_tid, const void *buf)
+{
+    mailbox_t *mbx;
+
+    if (buf == NULL) {
+        errno = EFAULT;
+        return NULL;
+    }
+    if (receiver_tid >= MAX_TASKS || g_tcbs[receiver_tid].state == DORMANT) {
+        errno = EINVAL;
+        return NULL;
+    }
+    mbx = &g_mbx[receiver_tid];
+    if (mbx->buf == NULL) {
+        errno = ENOENT;
+        return NULL;
+    }
+    if (((const RTX_MSG_HDR *) buf)->length < MIN_MSG_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return mbx;
+}
+
+/**
+ * @brief   checks of send_msg and send_msg_nb, the message must fit the ring
+ * @return  the receiver's mailbox, NULL with errno set on failure
+ */
+static mailbox_t *k_mbx_check_send(task_t receiver_tid, const void *buf)
+{
+    const RTX_MSG_HDR *msg = buf;
+    mailbox_t *mbx = k_mbx_of_receiver(receiver_tid, buf);
+
+    if (mbx == NULL) {
+        return NULL;
+    }
+    if (msg->length > mbx->size) {
+        errno = EMSGSIZE;
+        return NULL;
+    }
+    return mbx;
+}
+
+/**
+ * @brief   whether a sender has to wait for room in the ring
+ * @note    a running sender only overtakes waiters of lower priority. A
+ *          receiver waiting for the message takes it even from a full ring,
+ *          recv_msg_type may wait with other types queued.
+ */
+static int k_mbx_must_wait(task_t receiver_tid, const RTX_MSG_HDR *msg)
+{
+    mailbox_t *mbx = &g_mbx[receiver_tid];
+
+    if (k_mbx_in_recv(&g_tcbs[receiver_tid], msg)) {
+        return 0;
+    }
+    if (mbx->senders.head != NULL && mbx->senders.head->prio <= gp_current_task->prio) {
+        return 1;
+    }
+    return msg->length > mbx->size - mbx->used;
+}
+
+/**
+ * @brief   pass on a checked message
+ * @return  non-zero if the receiver was woken, RTX_ERR with errno ENOSPC
+ *          if a message above MSG_PRIO_NORMAL could not be queued
+ * @details A receiver blocked in recv_msg gets it copied straight into its
+ *          buffer and the ring is skipped, it is empty then anyway.
+ *          Otherwise the message is queued, which may wake a receiver
+ *          blocked in wait_any.
+ */
+static int k_mbx_put(task_t receiver_tid, const RTX_MSG_HDR *msg, task_t sender, U8 prio)
+{
+    TCB *p_tcb = &g_tcbs[receiver_tid];
+
+    if (k_mbx_in_recv(p_tcb, msg)) {
+        k_mbx_handoff(p_tcb, msg, sender);
+        return 1;
+    }
+    if (k_mbx_enqueue(&g_mbx[receiver_tid], msg, sender, prio) != RTX_OK) {
+        return RTX_ERR;
+    }
+    return k_ev_notify(receiver_tid);   // the receiver may wait in wait_any
+}
+
+/**
+ * @brief   pass on a checked message, switching to a receiver that outranks us
+ */
+static int k_mbx_deliver(task_t receiver_tid, const RTX_MSG_HDR *msg, U8 prio)
+{
+    int woken = k_mbx_put(receiver_tid, msg, gp_current_task->tid, prio);
+
+    if (woken == RTX_ERR) {
+        return RTX_ERR;
+    }
+    if (woken) {
+        return k_tsk_run_new();
+    }
+    return RTX_OK;
+}
+
+/**************************************************************************//**
+ * @brief   create the mailbox of the calling task
+ * @return  the mailbox id, which is the tid, RTX_ERR on failure
+ * @details The ring is allocated from MPID_IRAM2 like the task stacks, so
+ *          arena mode and the user heap never see it. k_mbx_release frees
+ *          it when the task exits.
+ *****************************************************************************/
 int k_mbx_create(size_t size) {
 #ifdef DEBUG_0
     printf("k_mbx_create: size = %u\r\n", size);
 #endif /* DEBUG_0 */
-    return 0;
+    mailbox_t *mbx = &g_mbx[gp_current_task->tid];
+
+    if (mbx->buf != NULL) {
+        errno = EEXIST;
+        return RTX_ERR;
+    }
+    if (size < MIN_MSG_SIZE || size > MBX_MAX_SIZE) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    mbx->buf = k_mpool_alloc(MPID_IRAM2, size);
+    if (mbx->buf == NULL) {
+        errno = ENOMEM;
+        return RTX_ERR;
+    }
+    mbx->size  = size;
+    mbx->head  = 0;
+    mbx->used  = 0;
+    mbx->ringUsed = 0;
+    mbx->count = 0;
+    mbx->prioMask = 0;
+    for (U8 prio = 0; prio < MSG_PRIO_NORMAL; prio++) {
+        mbx->prioHead[prio] = NULL;
+        mbx->prioTail[prio] = NULL;
+    }
+    mbx->ringTypes = 0;
+    for (U8 type = 0; type < MBX_NUM_TYPES; type++) {
+        mbx->typeCount[type] = 0;
+    }
+    mbx->stats.peakUsed      = 0;
+    mbx->stats.peakCount     = 0;
+    mbx->stats.nbDrops       = 0;
+    mbx->stats.blkSendCycles = 0;
+    for (U8 i = 0; i < MBX_LAT_BUCKETS; i++) {
+        mbx->stats.latency[i] = 0;
+    }
+    mbx->stats.stampHead  = 0;
+    mbx->stats.stampCount = 0;
+    mbx->senders.head = NULL;
+    mbx->senders.tail = NULL;
+    mbx->zcHead  = 0;
+    mbx->zcCount = 0;
+    return gp_current_task->tid;
+}
+
+/**
+ * @brief   common part of the blocking send calls
+ * @note    a blocked sender's prio is picked up again from its stacked SVC
+ *          arguments by k_mbx_wake_senders, only send_msg_prio has one
+ */
+static int k_mbx_send(task_t receiver_tid, const void *buf, U8 prio, U32 ticks)
+{
+    mailbox_t *mbx = k_mbx_check_send(receiver_tid, buf);
+
+    if (mbx == NULL) {
+        return RTX_ERR;
+    }
+    if (k_mbx_must_wait(receiver_tid, buf)) {
+        if (ticks == 0) {
+            errno = ETIMEDOUT;
+            return RTX_ERR;
+        }
+        // queued by the receiver's k_mbx_wake_senders once there is room
+        return k_tsk_block(BLK_SEND, &mbx->senders, ticks);
+    }
+    return k_mbx_deliver(receiver_tid, buf, prio);
 }
 
 int k_send_msg(task_t receiver_tid, const void *buf) {
 #ifdef DEBUG_0
     printf("k_send_msg: receiver_tid = %d, buf=0x%x\r\n", receiver_tid, buf);
 #endif /* DEBUG_0 */
-    return 0;
+    return k_send_msg_timeout(receiver_tid, buf, K_WAIT_FOREVER);
+}
+
+/**************************************************************************//**
+ * @brief   send_msg that gives up after ticks RTX ticks
+ * @return  RTX_OK on success, RTX_ERR with errno ETIMEDOUT if there was no
+ *          room in time, or the errno of send_msg
+ * @note    zero ticks fails at once when send_msg would block
+ *****************************************************************************/
+int k_send_msg_timeout(task_t receiver_tid, const void *buf, U32 ticks)
+{
+    return k_mbx_send(receiver_tid, buf, MSG_PRIO_NORMAL, ticks);
+}
+
+/**************************************************************************//**
+ * @brief   send_msg with a message priority
+ * @return  RTX_OK on success, RTX_ERR on failure
+ * @param   prio    MSG_PRIO_URGENT to MSG_PRIO_NORMAL, errno EINVAL otherwise
+ * @details The receiver takes queued messages highest priority first and in
+ *          FIFO order within a priority, so an urgent command overtakes bulk
+ *          data already in the mailbox. Room is still shared, the call
+ *          blocks like send_msg while the mailbox is full. A message above
+ *          MSG_PRIO_NORMAL waits in a list node from MPID_IRAM2. Without
+ *          memory for the node the call fails with ENOSPC rather than
+ *          queue the message behind the others.
+ *****************************************************************************/
+int k_send_msg_prio(task_t receiver_tid, const void *buf, U8 prio)
+{
+#ifdef DEBUG_0
+    printf("k_send_msg_prio: receiver_tid = %d, buf=0x%x, prio=%u\r\n", receiver_tid, buf, prio);
+#endif /* DEBUG_0 */
+    if (prio >= NUM_MSG_PRIOS) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    return k_mbx_send(receiver_tid, buf, prio, K_WAIT_FOREVER);
 }
 
 int k_send_msg_nb(task_t receiver_tid, const void *buf) {
 #ifdef DEBUG_0
     printf("k_send_msg_nb: receiver_tid = %d, buf=0x%x\r\n", receiver_tid, buf);
 #endif /* DEBUG_0 */
-    return 0;
+    mailbox_t *mbx = k_mbx_check_send(receiver_tid, buf);
+
+    if (mbx == NULL) {
+        return RTX_ERR;
+    }
+    if (k_mbx_must_wait(receiver_tid, buf)) {
+        mbx->stats.nbDrops++;
+        errno = ENOSPC;
+        return RTX_ERR;
+    }
+    return k_mbx_deliver(receiver_tid, buf, MSG_PRIO_NORMAL);
+}
+
+/**
+ * @brief   common part of recv_msg and recv_msg_nb
+ * @return  the calling task's mailbox, NULL with errno set on failure
+ */
+static mailbox_t *k_mbx_check_recv(void *buf)
+{
+    mailbox_t *mbx = &g_mbx[gp_current_task->tid];
+
+    if (mbx->buf == NULL) {
+        errno = ENOENT;
+        return NULL;
+    }
+    if (buf == NULL) {
+        errno = EFAULT;
+        return NULL;
+    }
+    return mbx;
+}
+
+/**
+ * @brief   dequeue into buf and let blocked senders refill the ring
+ */
+static int k_mbx_take(mailbox_t *mbx, void *buf, size_t len)
+{
+    int ret = k_mbx_dequeue(mbx, buf, len);
+
+    if (k_mbx_wake_senders(gp_current_task->tid)) {
+        k_tsk_run_new();            // a woken sender may outrank the receiver
+    }
+    return ret;
 }
 
 int k_recv_msg(void *buf, size_t len) {
 #ifdef DEBUG_0
     printf("k_recv_msg: buf=0x%x, len=%d\r\n", buf, len);
 #endif /* DEBUG_0 */
+    return k_recv_msg_timeout(buf, len, K_WAIT_FOREVER);
+}
+
+/**************************************************************************//**
+ * @brief   recv_msg that gives up after ticks RTX ticks
+ * @return  RTX_OK on success, RTX_ERR with errno ETIMEDOUT if no message
+ *          arrived in time, or the errno of recv_msg
+ * @note    zero ticks fails at once on an empty mailbox
+ *****************************************************************************/
+int k_recv_msg_timeout(void *buf, size_t len, U32 ticks)
+{
+    mailbox_t *mbx = k_mbx_check_recv(buf);
+
+    if (mbx == NULL) {
+        return RTX_ERR;
+    }
+    if (mbx->count == 0) {
+        if (ticks == 0) {
+            errno = ETIMEDOUT;
+            return RTX_ERR;
+        }
+        // the next sender copies into buf for us, see k_mbx_handoff
+        return k_tsk_block(BLK_RECV, NULL, ticks);
+    }
+    return k_mbx_take(mbx, buf, len);
+}
+
+/**************************************************************************//**
+ * @brief   receive as many queued messages as fit in one call
+ * @return  number of messages copied, RTX_ERR on failure
+ * @param   buf         receives the messages back to back, each with its header
+ * @param   len         size of buf in bytes
+ * @param   max_msgs    most messages to take
+ * @details Blocks like recv_msg while the mailbox is empty, the sender
+ *          that wakes the task hands over one message. Messages that do
+ *          not fit stay queued. Only when not even the oldest fits does the
+ *          call fail with ENOSPC and drop it, as recv_msg does.
+ *****************************************************************************/
+int k_recv_msg_batch(void *buf, size_t len, size_t max_msgs)
+{
+#ifdef DEBUG_0
+    printf("k_recv_msg_batch: buf=0x%x, len=%d, max_msgs=%d\r\n", buf, len, max_msgs);
+#endif /* DEBUG_0 */
+    mailbox_t *mbx = k_mbx_check_recv(buf);
+    msg_ref_t *ref;
+    U32 msg_len;
+    U8 *dst = buf;
+    size_t n = 0;
+    int ret;
+
+    if (mbx == NULL) {
+        return RTX_ERR;
+    }
+    if (max_msgs == 0) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    if (mbx->count == 0) {
+        return k_tsk_block(BLK_RECV, NULL, K_WAIT_FOREVER);
+    }
+
+    while (n < max_msgs && mbx->count != 0) {
+        msg_len = k_mbx_front(mbx, &ref);
+        if (msg_len > len) {
+            break;
+        }
+        k_mbx_pop(mbx, dst);
+        dst += msg_len;
+        len -= msg_len;
+        n++;
+    }
+    ret = (n != 0) ? (int) n : k_mbx_dequeue(mbx, buf, len);
+
+    if (k_mbx_wake_senders(gp_current_task->tid)) {
+        k_tsk_run_new();            // a woken sender may outrank the receiver
+    }
+    return ret;
+}
+
+/**************************************************************************//**
+ * @brief   send several messages to one task in one call
+ * @return  number of messages sent, RTX_ERR if none was
+ * @param   buf         num_msgs messages back to back, each with its header
+ * @details Never blocks. Messages are passed on in order until one does not
+ *          fit, the rest is left to the caller. A receiver blocked in a
+ *          receive call gets the first one directly, and any switch to it
+ *          waits until the whole batch is queued.
+ *****************************************************************************/
+int k_send_msg_batch(task_t receiver_tid, const void *buf, size_t num_msgs)
+{
+#ifdef DEBUG_0
+    printf("k_send_msg_batch: receiver_tid = %d, buf=0x%x, num_msgs=%d\r\n", receiver_tid, buf, num_msgs);
+#endif /* DEBUG_0 */
+    const U8 *src = buf;
+    mailbox_t *mbx;
+    size_t n = 0;
+    int woken = 0;
+
+    if (num_msgs == 0) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    for (; n < num_msgs; n++) {
+        mbx = k_mbx_check_send(receiver_tid, src);
+        if (mbx == NULL) {
+            break;
+        }
+        if (k_mbx_must_wait(receiver_tid, (const RTX_MSG_HDR *) src)) {
+            mbx->stats.nbDrops++;
+            errno = ENOSPC;
+            break;
+        }
+        woken |= k_mbx_put(receiver_tid, (const RTX_MSG_HDR *) src, gp_current_task->tid, MSG_PRIO_NORMAL);
+        src += ((const RTX_MSG_HDR *) src)->length;
+    }
+    if (woken) {
+        k_tsk_run_new();
+    }
+    return (n != 0) ? (int) n : RTX_ERR;
+}
+
+/**
+ * @brief   take the first listed message of a type in type_mask
+ * @return  non-zero if one matched, *ret is then the receive result
+ * @note    the lists hold the few messages sent above MSG_PRIO_NORMAL and
+ *          are walked, only the ring is indexed
+ */
+static int k_mbx_take_node(mailbox_t *mbx, void *buf, size_t len, U32 type_mask, int *ret)
+{
+    for (U8 prio = 0; prio < MSG_PRIO_NORMAL; prio++) {
+        mbx_node_t *prev = NULL;
+        mbx_node_t *node;
+
+        for (node = mbx->prioHead[prio]; node != NULL; prev = node, node = node->next) {
+            if (k_mbx_type_in(node->msg.type, type_mask)) {
+                break;
+            }
+        }
+        if (node == NULL) {
+            continue;
+        }
+        if (prev == NULL) {
+            mbx->prioHead[prio] = node->next;
+        } else {
+            prev->next = node->next;
+        }
+        if (mbx->prioTail[prio] == node) {
+            mbx->prioTail[prio] = prev;
+        }
+        if (mbx->prioHead[prio] == NULL) {
+            mbx->prioMask &= ~(1U << prio);
+        }
+        mbx->count--;
+        mbx->used -= node->msg.length;
+        if (node->msg.length > len) {
+            errno = ENOSPC;
+            *ret = RTX_ERR;
+        } else {
+            k_mem_copy(buf, &node->msg, node->msg.length);
+            k_mbx_latency(mbx, K_CYCLES() - node->stamp);
+            *ret = RTX_OK;
+        }
+        k_mpool_dealloc(MPID_IRAM2, node);
+        return 1;
+    }
     return 0;
 }
 
+/**
+ * @brief   take the oldest ring message of a type in type_mask
+ * @pre     mbx->ringTypes & type_mask is non-zero
+ * @details The type index gives the oldest message of each type, the one
+ *          closest to the head wins. A message taken out of the middle is
+ *          marked MBX_DEAD_TID and its bytes come back once the head
+ *          reaches it.
+ */
+static int k_mbx_take_rec(mailbox_t *mbx, void *buf, size_t len, U32 type_mask)
+{
+    U32 types = mbx->ringTypes & type_mask;
+    U32 best = mbx->size;
+    U32 off = 0;
+    RTX_MSG_HDR hdr;
+    msg_ref_t *ref;
+    int ret = RTX_OK;
+
+    while (types != 0) {
+        U8 type = log_two_floor(types & -types);
+        U32 first = mbx->typeFirst[type];
+        U32 age = (first >= mbx->head) ? first - mbx->head : first + mbx->size - mbx->head;
+
+        if (age < best) {
+            best = age;
+            off = first;
+        }
+        types &= types - 1;
+    }
+    k_mbx_peek_at(mbx, off, &hdr, MSG_HDR_SIZE);
+    k_mbx_index_del(mbx, off, &hdr);
+    if (k_mbx_rec_len(mbx, off, &ref) > len) {
+        buf = NULL;
+        errno = ENOSPC;
+        ret = RTX_ERR;
+    }
+    k_mbx_stamp_take(mbx, off, buf != NULL);
+    k_mbx_rec_copy(mbx, off, buf);
+    // sender_tid follows the U32 length of the header
+    mbx->buf[k_mbx_next_off(mbx, off, sizeof(U32))] = MBX_DEAD_TID;
+    mbx->count--;
+    k_mbx_reclaim(mbx);
+    return ret;
+}
+
+/**
+ * @brief   take the message of a blocked sender if its type is in type_mask
+ * @return  non-zero if one matched, *ret is then the receive result
+ * @note    lets recv_msg_type get a message that is waiting for room,
+ *          the ring may be full of other types
+ */
+static int k_mbx_take_sender(mailbox_t *mbx, void *buf, size_t len, U32 type_mask, int *ret)
+{
+    TCB *p_tcb;
+
+    for (p_tcb = mbx->senders.head; p_tcb != NULL; p_tcb = p_tcb->next) {
+        RTX_MSG_HDR *msg = (RTX_MSG_HDR *) p_tcb->svcFrame[1];
+
+        if (!k_mbx_type_in(msg->type, type_mask)) {
+            continue;
+        }
+        if (msg->length > len) {
+            errno = ENOSPC;
+            *ret = RTX_ERR;
+        } else {
+            k_mem_copy(buf, msg, msg->length);
+            ((RTX_MSG_HDR *) buf)->sender_tid = p_tcb->tid;
+            k_mbx_latency(mbx, K_CYCLES() - p_tcb->blockedAt);
+            *ret = RTX_OK;
+        }
+        k_tsk_unblock(p_tcb, RTX_OK);
+        return 1;
+    }
+    return 0;
+}
+
+/**************************************************************************//**
+ * @brief   receive the oldest message whose type is in type_mask
+ * @return  RTX_OK on success, RTX_ERR on failure
+ * @param   type_mask   bit t selects type t, types from MBX_NUM_TYPES up
+ *                      can not be selected
+ * @details Messages of other types stay queued in order. Urgent messages
+ *          are looked at first, then the ring through its per-type index,
+ *          so the mailbox is not rescanned. With no match the call blocks
+ *          until a sender hands over one. A match longer than len is
+ *          dropped and the call fails with ENOSPC, as in recv_msg.
+ *****************************************************************************/
+int k_recv_msg_type(void *buf, size_t len, U32 type_mask)
+{
+#ifdef DEBUG_0
+    printf("k_recv_msg_type: buf=0x%x, len=%d, type_mask=0x%x\r\n", buf, len, type_mask);
+#endif /* DEBUG_0 */
+    mailbox_t *mbx = k_mbx_check_recv(buf);
+    int ret;
+
+    if (mbx == NULL) {
+        return RTX_ERR;
+    }
+    if (type_mask == 0) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    if (k_mbx_take_node(mbx, buf, len, type_mask, &ret)) {
+        return ret;
+    }
+    if ((mbx->ringTypes & type_mask) != 0) {
+        ret = k_mbx_take_rec(mbx, buf, len, type_mask);
+    } else if (!k_mbx_take_sender(mbx, buf, len, type_mask, &ret)) {
+        // the next sender of a matching type copies into buf for us
+        return k_tsk_block(BLK_RECV, NULL, K_WAIT_FOREVER);
+    }
+    if (k_mbx_wake_senders(gp_current_task->tid)) {
+        k_tsk_run_new();            // a woken sender may outrank the receiver
+    }
+    return ret;
+}
+
+/**************************************************************************//**
+ * @brief   pass keystrokes the UART0 handler queued on to the KCD task
+ * @return  non-zero if the KCD task was woken
+ * @details Called every RTX tick from k_tsk_tick. The waiting chars go out
+ *          as one KEY_IN message from TID_UART, up to UART_RX_BATCH of them
+ *          and as many as the KCD mailbox or its blocked receive call takes.
+ *          The rest stays in the lock-free RX ring for the next tick, so
+ *          nothing is lost while the ring has room. Without a KCD mailbox
+ *          the ring fills and uart_irq.c counts the drops.
+ *****************************************************************************/
+int k_mbx_uart_rx(void)
+{
+    struct {
+        RTX_MSG_HDR hdr;
+        U8          data[UART_RX_BATCH];
+    } msg;
+    TCB *p_tcb = &g_tcbs[TID_KCD];
+    mailbox_t *mbx = &g_mbx[TID_KCD];
+    U32 room;
+    U32 n;
+
+    if (p_tcb->state == DORMANT || mbx->buf == NULL) {
+        return 0;
+    }
+    msg.hdr.sender_tid = TID_UART;
+    msg.hdr.type = KEY_IN;
+    if (k_mbx_in_recv(p_tcb, &msg.hdr)) {
+        room = p_tcb->svcFrame[1];          // len of the receive call
+    } else if (mbx->senders.head == NULL) {
+        room = mbx->size - mbx->used;
+    } else {
+        return 0;                           // blocked senders go first
+    }
+    if (room <= MSG_HDR_SIZE) {
+        return 0;
+    }
+    room -= MSG_HDR_SIZE;
+    n = uart_rx_get(msg.data, (room < UART_RX_BATCH) ? room : UART_RX_BATCH);
+    if (n == 0) {
+        return 0;
+    }
+    msg.hdr.length = MSG_HDR_SIZE + n;
+    return k_mbx_put(TID_KCD, &msg.hdr, TID_UART, MSG_PRIO_NORMAL);
+}
+
 int k_recv_msg_nb(void *buf, size_t len) {
 #ifdef DEBUG_0
     printf("k_recv_msg_nb: buf=0x%x, len=%d\r\n", buf, len);
 #endif /* DEBUG_0 */
-    return 0;
+    mailbox_t *mbx = k_mbx_check_recv(buf);
+
+    if (mbx == NULL) {
+        return RTX_ERR;
+    }
+    if (mbx->count == 0) {
+        errno = ENOMSG;
+        return RTX_ERR;
+    }
+    return k_mbx_take(mbx, buf, len);
 }
 
 int k_mbx_ls(task_t *buf, size_t count) {
 #ifdef DEBUG_0
     printf("k_mbx_ls: buf=0x%x, count=%u\r\n", buf, count);
 #endif /* DEBUG_0 */
-    return 0;
+    size_t n = 0;
+
+    if (buf == NULL) {
+        errno = EFAULT;
+        return RTX_ERR;
+    }
+    for (task_t tid = 0; tid < MAX_TASKS && n < count; tid++) {
+        if (g_tcbs[tid].state != DORMANT && g_mbx[tid].buf != NULL) {
+            buf[n++] = tid;
+        }
+    }
+    return n;
 }
 
+/**
+ * @brief   free space of a mailbox in bytes
+ */
 int k_mbx_get(task_t tid)
 {
 #ifdef DEBUG_0
     printf("k_mbx_get: tid=%u\r\n", tid);
 #endif /* DEBUG_0 */
-    return 0;
+    if (tid >= MAX_TASKS || g_tcbs[tid].state == DORMANT) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    if (g_mbx[tid].buf == NULL) {
+        errno = ENOENT;
+        return RTX_ERR;
+    }
+    return g_mbx[tid].size - g_mbx[tid].used;
+}
+
+/**************************************************************************//**
+ * @brief   fill a caller buffer with the statistics of a mailbox
+ * @return  RTX_OK on success, RTX_ERR on failure
+ * @details Occupancy, high-water marks, refused non-blocking sends, time
+ *          spent by senders in BLK_SEND and a histogram of send-to-receive
+ *          latencies, to size mailboxes from measurements. Copying receives
+ *          are timed, send_msg_zc buffers are not. Only MBX_STAMP_DEPTH ring
+ *          messages are timed at once, a deeper backlog is sampled.
+ *****************************************************************************/
+int k_mbx_stats(task_t tid, MBX_STATS *buffer)
+{
+#ifdef DEBUG_0
+    printf("k_mbx_stats: tid=%u, buffer=0x%x\r\n", tid, buffer);
+#endif /* DEBUG_0 */
+    mailbox_t *mbx;
+
+    if (buffer == NULL) {
+        errno = EFAULT;
+        return RTX_ERR;
+    }
+    if (k_mbx_get(tid) == RTX_ERR) {
+        return RTX_ERR;
+    }
+    mbx = &g_mbx[tid];
+    buffer->size            = mbx->size;
+    buffer->bytes_used      = mbx->used;
+    buffer->peak_used       = mbx->stats.peakUsed;
+    buffer->num_msgs        = mbx->count;
+    buffer->peak_msgs       = mbx->stats.peakCount;
+    buffer->nb_drops        = mbx->stats.nbDrops;
+    buffer->blk_send_cycles = mbx->stats.blkSendCycles;
+    for (U8 i = 0; i < MBX_LAT_BUCKETS; i++) {
+        buffer->latency[i] = mbx->stats.latency[i];
+    }
+    return RTX_OK;
+}
+
+/**
+ * @brief   add the time a sender spent in BLK_SEND to its receiver's mailbox
+ * @note    called by k_tsk_unblock, the receiver tid is the first argument
+ *          of every send call
+ */
+void k_mbx_send_waited(TCB *p_tcb)
+{
+    g_mbx[(task_t) p_tcb->svcFrame[0]].stats.blkSendCycles += K_CYCLES() - p_tcb->blockedAt;
+}
+
+/**************************************************************************//**
+ * @brief   pass a mem_alloc'd message to a task by pointer
+ * @return  RTX_OK on success, RTX_ERR on failure
+ * @param   buf     RTX_MSG_HDR framed message in a block the caller owns
+ * @details Ownership of the block moves to receiver_tid through k_mem_give,
+ *          the caller must not touch buf afterwards. Nothing is copied, the
+ *          kernel only fills in sender_tid. Up to MBX_ZC_DEPTH buffers wait
+ *          per mailbox beside its ring, the call fails with ENOSPC beyond.
+ *****************************************************************************/
+int k_send_msg_zc(task_t receiver_tid, void *buf)
+{
+#ifdef DEBUG_0
+    printf("k_send_msg_zc: receiver_tid = %d, buf=0x%x\r\n", receiver_tid, buf);
+#endif /* DEBUG_0 */
+    mailbox_t *mbx = k_mbx_of_receiver(receiver_tid, buf);
+    TCB *p_tcb = &g_tcbs[receiver_tid];
+
+    if (mbx == NULL) {
+        return RTX_ERR;
+    }
+    if (mbx->zcCount == MBX_ZC_DEPTH) {
+        errno = ENOSPC;
+        return RTX_ERR;
+    }
+    if (k_mem_give(buf, receiver_tid) != RTX_OK) {
+        return RTX_ERR;
+    }
+    ((RTX_MSG_HDR *) buf)->sender_tid = gp_current_task->tid;
+
+    if (p_tcb->state == BLK_RECV && k_mbx_wait_svc(p_tcb) == SVC_MBX_RECV_ZC) {
+        *(void **) p_tcb->svcFrame[0] = buf;
+        k_tsk_unblock(p_tcb, RTX_OK);
+        return k_tsk_run_new();     // the receiver may outrank the sender
+    }
+    mbx->zc[(mbx->zcHead + mbx->zcCount) % MBX_ZC_DEPTH] = buf;
+    mbx->zcCount++;
+    if (k_ev_notify(receiver_tid)) {
+        return k_tsk_run_new();
+    }
+    return RTX_OK;
+}
+
+/**
+ * @brief   take the oldest send_msg_zc buffer, blocking while there is none
+ * @note    the caller owns *buf afterwards and frees it with mem_dealloc
+ */
+int k_recv_msg_zc(void **buf)
+{
+#ifdef DEBUG_0
+    printf("k_recv_msg_zc: buf=0x%x\r\n", buf);
+#endif /* DEBUG_0 */
+    mailbox_t *mbx = k_mbx_check_recv(buf);
+
+    if (mbx == NULL) {
+        return RTX_ERR;
+    }
+    if (mbx->zcCount == 0) {
+        // the next send_msg_zc stores into *buf for us
+        return k_tsk_block(BLK_RECV, NULL, K_WAIT_FOREVER);
+    }
+    *buf = mbx->zc[mbx->zcHead];
+    mbx->zcHead = (mbx->zcHead + 1) % MBX_ZC_DEPTH;
+    mbx->zcCount--;
+    return RTX_OK;
+}
+
+/**
+ * @brief   topic descriptor check shared by the topic calls
+ */
+static int k_topic_valid(topic_t topic)
+{
+    return topic >= 0 && topic < MAX_TOPICS && g_topics[topic].name[0] != '\0';
+}
+
+/**************************************************************************//**
+ * @brief   find the topic of a name, creating it on first use
+ * @return  the topic descriptor, RTX_ERR on failure
+ * @param   name    NUL terminated, 1 to TOPIC_NAME_LEN - 1 characters
+ * @details Topics are never destroyed, all tasks opening the same name get
+ *          the same descriptor. Fails with EFAULT for a NULL name, EINVAL
+ *          for an empty or too long one and ENOMEM when all MAX_TOPICS are
+ *          taken.
+ *****************************************************************************/
+topic_t k_topic_open(const char *name)
+{
+#ifdef DEBUG_0
+    printf("k_topic_open: name=0x%x\r\n", name);
+#endif /* DEBUG_0 */
+    topic_t free_slot = RTX_ERR;
+    U32 len = 0;
+
+    if (name == NULL) {
+        errno = EFAULT;
+        return RTX_ERR;
+    }
+    while (len < TOPIC_NAME_LEN && name[len] != '\0') {
+        len++;
+    }
+    if (len == 0 || len == TOPIC_NAME_LEN) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    for (topic_t topic = 0; topic < MAX_TOPICS; topic++) {
+        char *slot = g_topics[topic].name;
+        U32 i = 0;
+
+        if (slot[0] == '\0') {
+            if (free_slot == RTX_ERR) {
+                free_slot = topic;
+            }
+            continue;
+        }
+        while (i < len && slot[i] == name[i]) {
+            i++;
+        }
+        if (i == len && slot[i] == '\0') {
+            return topic;
+        }
+    }
+    if (free_slot == RTX_ERR) {
+        errno = ENOMEM;
+        return RTX_ERR;
+    }
+    k_mem_copy(g_topics[free_slot].name, name, len + 1);
+    g_topics[free_slot].subs = 0;
+    return free_slot;
+}
+
+/**
+ * @brief   have the messages published to a topic queued in the caller's mailbox
+ * @note    fails with ENOENT if the caller has no mailbox, subscribing twice
+ *          is harmless
+ */
+int k_topic_subscribe(topic_t topic)
+{
+#ifdef DEBUG_0
+    printf("k_topic_subscribe: topic=%d\r\n", topic);
+#endif /* DEBUG_0 */
+    if (!k_topic_valid(topic)) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    if (g_mbx[gp_current_task->tid].buf == NULL) {
+        errno = ENOENT;
+        return RTX_ERR;
+    }
+    g_topics[topic].subs |= 1U << gp_current_task->tid;
+    return RTX_OK;
+}
+
+/**
+ * @brief   stop receiving a topic, messages already queued stay queued
+ */
+int k_topic_unsubscribe(topic_t topic)
+{
+#ifdef DEBUG_0
+    printf("k_topic_unsubscribe: topic=%d\r\n", topic);
+#endif /* DEBUG_0 */
+    if (!k_topic_valid(topic)) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    g_topics[topic].subs &= ~(1U << gp_current_task->tid);
+    return RTX_OK;
+}
+
+/**************************************************************************//**
+ * @brief   send one message to every subscriber of a topic
+ * @return  number of subscribers that got the message, RTX_ERR on failure
+ * @param   buf     RTX_MSG_HDR framed message, sender_tid is filled in
+ * @details The payload is copied once into a msg_ref_t from MPID_IRAM2 and
+ *          each subscriber's ring only gets a small mbx_ref_rec_t pointing
+ *          to it. The payload still counts against every subscriber's
+ *          mailbox size, so mbx_get and mbx_stats see the same room as
+ *          after a send_msg of the message. A subscriber blocked in a
+ *          receive call gets the message copied straight into its buffer
+ *          instead. Never blocks: a subscriber without that room, or with
+ *          blocked senders waiting, misses the message and is not counted.
+ *****************************************************************************/
+int k_topic_publish(topic_t topic, const void *buf)
+{
+#ifdef DEBUG_0
+    printf("k_topic_publish: topic=%d, buf=0x%x\r\n", topic, buf);
+#endif /* DEBUG_0 */
+    const RTX_MSG_HDR *msg = buf;
+    msg_ref_t *ref = NULL;
+    mbx_ref_rec_t rec;
+    int n = 0;
+    int woken = 0;
+    int nomem = 0;
+
+    if (buf == NULL) {
+        errno = EFAULT;
+        return RTX_ERR;
+    }
+    if (!k_topic_valid(topic) || msg->length < MIN_MSG_SIZE) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+    for (task_t tid = 0; tid < MAX_TASKS; tid++) {
+        mailbox_t *mbx = &g_mbx[tid];
+
+        if ((g_topics[topic].subs & (1U << tid)) == 0) {
+            continue;
+        }
+        if (k_mbx_in_recv(&g_tcbs[tid], msg)) {
+            k_mbx_handoff(&g_tcbs[tid], msg, gp_current_task->tid);
+            woken = 1;
+            n++;
+            continue;
+        }
+        if (mbx->senders.head != NULL ||
+            sizeof(mbx_ref_rec_t) + k_mbx_ref_extra(msg->length) > mbx->size - mbx->used) {
+            continue;
+        }
+        if (ref == NULL) {
+            ref = k_mpool_alloc(MPID_IRAM2, sizeof(U32) + msg->length);
+            if (ref == NULL) {
+                nomem = 1;
+                continue;   // blocked receivers can still be served
+            }
+            ref->refs = 0;
+            k_mem_copy(&ref->msg, msg, msg->length);
+            ref->msg.sender_tid = gp_current_task->tid;
+        }
+        rec.hdr.length     = sizeof(mbx_ref_rec_t);
+        rec.hdr.sender_tid = MBX_REF_TID;
+        rec.hdr.type       = msg->type;
+        rec.ref            = ref;
+        k_mbx_index_add(mbx, rec.hdr.type);
+        k_mbx_stamp_add(mbx);
+        k_mbx_write(mbx, &rec, sizeof(mbx_ref_rec_t));
+        mbx->used += k_mbx_ref_extra(msg->length);
+        mbx->count++;
+        k_mbx_peak(mbx);
+        ref->refs++;
+        n++;
+        woken |= k_ev_notify(tid);
+    }
+    if (woken) {
+        k_tsk_run_new();            // a woken subscriber may outrank the publisher
+    }
+    if (n == 0 && nomem) {
+        errno = ENOMEM;
+        return RTX_ERR;
+    }
+    return n;
+}
+
+/**
+ * @brief   free the mailbox of an exiting task
+ * @details Queued messages are dropped and queued send_msg_zc buffers are
+ *          freed. Senders still blocked on the mailbox wake up with RTX_ERR
+ *          and errno ENOENT. The task leaves all topics.
+ */
+void k_mbx_release(task_t tid)
+{
+    mailbox_t *mbx = &g_mbx[tid];
+
+    if (mbx->buf == NULL) {
+        return;
+    }
+    for (topic_t topic = 0; topic < MAX_TOPICS; topic++) {
+        g_topics[topic].subs &= ~(1U << tid);
+    }
+    while (mbx->count != 0) {
+        k_mbx_pop(mbx, NULL);       // drops the references to published messages
+    }
+    while (mbx->senders.head != NULL) {
+        errno = ENOENT;
+        k_tsk_unblock(mbx->senders.head, RTX_ERR);
+    }
+    for (; mbx->zcCount != 0; mbx->zcCount--) {
+        k_mpool_dealloc(MPID_IRAM1, mbx->zc[mbx->zcHead]);
+        mbx->zcHead = (mbx->zcHead + 1) % MBX_ZC_DEPTH;
+    }
+    k_mpool_dealloc(MPID_IRAM2, mbx->buf);
+    mbx->buf = NULL;
 }
 /*
  *===========================================================================
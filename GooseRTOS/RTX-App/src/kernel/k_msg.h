@@ -48,6 +48,22 @@ int k_recv_msg      (void *buf, size_t len);
 int k_recv_msg_nb   (void *buf, size_t len);
 int k_mbx_ls        (task_t *buf, size_t count);
 int k_mbx_get       (task_t tid);
+void k_mbx_release  (task_t tid);
+int k_send_msg_zc   (task_t receiver_tid, void *buf);
+int k_recv_msg_zc   (void **buf);
+int k_send_msg_timeout  (task_t receiver_tid, const void *buf, U32 ticks);
+int k_recv_msg_timeout  (void *buf, size_t len, U32 ticks);
+int k_recv_msg_batch    (void *buf, size_t len, size_t max_msgs);
+int k_send_msg_batch    (task_t receiver_tid, const void *buf, size_t num_msgs);
+topic_t k_topic_open    (const char *name);
+int k_topic_subscribe   (topic_t topic);
+int k_topic_unsubscribe (topic_t topic);
+int k_topic_publish     (topic_t topic, const void *buf);
+int k_send_msg_prio     (task_t receiver_tid, const void *buf, U8 prio);
+int k_recv_msg_type     (void *buf, size_t len, U32 type_mask);
+int k_mbx_uart_rx       (void);
+int k_mbx_stats         (task_t tid, MBX_STATS *buffer);
+void k_mbx_send_waited  (TCB *p_tcb);
 
 #endif // ! K_MSG_H_
 
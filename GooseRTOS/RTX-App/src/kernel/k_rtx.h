@@ -44,6 +44,7 @@
 #include "k_mem.h"          // lab1
 #include "k_task.h"         // lab2
 #include "k_msg.h"          // lab3
+#include "k_event.h"
 #include "uart_irq.h"       // lab3
 #include "timer.h"          // lab4
 #endif // ! K_RTX_H_ 
@@ -54,7 +54,9 @@ int errno = 0;
  *****************************************************************************/
 int k_pre_rtx_init (void *args)
 {
-    if ( k_mem_init(((RTX_SYS_INFO *)(args))->mem_algo) != RTX_OK) {
+    RTX_SYS_INFO *sys_info = (RTX_SYS_INFO *) args;
+
+    if ( k_mem_init(sys_info->mem_algo, sys_info->mem_cache) != RTX_OK) {
         return RTX_ERR;
     }
     
@@ -73,6 +75,9 @@ int k_rtx_init(RTX_SYS_INFO *sys_info, TASK_INIT *tasks, int num_tasks)
     }
     
     /* add timer(s) initialization code */
+    if ( timer_irq_init(TIMER0) != 0 ) {    // drives k_tsk_tick
+        return RTX_ERR;
+    }
     
     if ( k_tsk_init(tasks, num_tasks) != RTX_OK ) {
         return RTX_ERR;
@@ -80,6 +85,8 @@ int k_rtx_init(RTX_SYS_INFO *sys_info, TASK_INIT *tasks, int num_tasks)
     
     /* add message passing initialization code */
     
+    k_tsk_guard_init();
+    k_tsk_guard_set(gp_current_task);
     k_tsk_start();        // start the first task
     return RTX_OK;
 }
@@ -69,6 +69,17 @@ TCB             g_tcbs[MAX_TASKS];                  // an array of TCBs
 //TASK_INIT       g_null_task_info;                 // The null task info
 U32             g_num_active_tasks = 0;             // number of non-dormant tasks
 tsk_ready_queue_t readyQueues[LOWEST - HIGH + 1];   // ready queues for each priority
+TCB             *gp_timeouts = NULL;                // blocked tasks with a timeout, soonest first
+#ifdef K_SHARED_STACK
+TCB             *gp_switch_from = NULL;             // context PendSV_Handler saves, NULL if none
+#endif
+
+static void k_push_back_ready_queue(tsk_ready_queue_t* queue, TCB *task);
+static void k_tsk_wait_insert(tsk_ready_queue_t *queue, TCB *task);
+static void k_tsk_timer_arm(TCB *task, U32 ticks);
+static void k_tsk_timer_cancel(TCB *task);
+static void k_tsk_unlink(tsk_ready_queue_t *queue, TCB *task);
+static void k_tsk_dequeue(TCB *task);
 
 /*---------------------------------------------------------------------------
 The memory map of the OS image may look like the following:
@@ -79,9 +90,7 @@ The memory map of the OS image may look like the following:
                               |   (for user space heap  ) |
                               |                           |
                  RAM1_START-->|---------------------------|
-                              |                           |
-                              |  unmanaged free space     |
-                              |                           |
+                              |  padding to RAM1_ALIGN    |
 &Image$$RW_IRAM1$$ZI$$Limit-->|---------------------------|-----+-----
                               |         ......            |     ^
                               |---------------------------|     |
@@ -143,7 +152,9 @@ TCB *scheduler(void)
         highestPriorityReady++; 
     }
     if(highestPriorityReady > LOWEST_PRIORITY_INDEX){
-        return NULL; // ready queues are empty
+        // ready queues are empty, the null task is never queued
+        g_tcbs[TID_NULL].state = RUNNING;
+        return &g_tcbs[TID_NULL];
     }
 
     readyQueues[highestPriorityReady].head->state = RUNNING;
@@ -183,6 +194,13 @@ int k_tsk_init(TASK_INIT *task, int num_tasks)
     
     TASK_INIT taskinfo;
     
+#ifdef K_SHARED_STACK
+    // painted once here, k_rtx_init still runs on the startup stack
+    k_alloc_k_stack(TID_NULL);
+    // switches wait until no SVC or interrupt handler is on the stack
+    NVIC_SetPriority(PendSV_IRQn, 0xFF);
+#endif
+
     k_tsk_init_first(&taskinfo);
     if ( k_tsk_create_new(&taskinfo, &g_tcbs[TID_NULL], TID_NULL) == RTX_OK ) {
         g_num_active_tasks = 1;
@@ -205,6 +223,7 @@ int k_tsk_init(TASK_INIT *task, int num_tasks)
 /**************************************************************************//**
  * @brief       initialize a new task in the system,
  *              one dummy kernel stack frame, one dummy user stack frame
+ *              (K_SHARED_STACK: both frames on the user stack)
  *
  * @return      RTX_OK on success; RTX_ERR on failure
  * @param       p_taskinfo  task initialization structure pointer
@@ -217,14 +236,20 @@ int k_tsk_init(TASK_INIT *task, int num_tasks)
  *              The PC is the entry point of the user task
  *              The kLR is set to SVC_RESTORE
  *              20 registers in total
+ *              With K_SHARED_STACK the task owns no kernel stack. CONTROL
+ *              and R4-R11 go below the exception frame on the user stack,
+ *              in the layout PendSV_Handler saves, 17 registers in total.
  * @note        YOU NEED TO MODIFY THIS FILE!!!
  *****************************************************************************/
 int k_tsk_create_new(TASK_INIT *p_taskinfo, TCB *p_tcb, task_t tid)
 {
+#ifndef K_SHARED_STACK
     extern U32 SVC_RTE;
 
-    U32 *usp;
     U32 *ksp;
+#endif
+    U32 *usp;
+    U32  control;
 
     if (p_taskinfo == NULL || p_tcb == NULL)
     {
@@ -235,16 +260,22 @@ int k_tsk_create_new(TASK_INIT *p_taskinfo, TCB *p_tcb, task_t tid)
     p_tcb->state = READY;
     p_tcb->prio  = p_taskinfo->prio;
     p_tcb->priv  = p_taskinfo->priv;
+    p_tcb->heap  = MPID_IRAM1;
+    p_tcb->waitq = NULL;
+    p_tcb->tprev = NULL;
+    p_tcb->tnext = NULL;
+    p_tcb->tdelta = 0;
+    p_tcb->timedOut = 0;
+    p_tcb->ptask = p_taskinfo->ptask;
+    p_tcb->stackSize = p_taskinfo->u_stack_size;
     
     /*---------------------------------------------------------------
-     *  Step1: allocate user stack for the task
+     *  Step1: allocate user stack for the task from MPID_IRAM2
      *         stacks grows down, stack base is at the high address
-     * ATTENTION: you need to modify the following three lines of code
-     *            so that you use your own dynamic memory allocator
-     *            to allocate variable size user stack.
+     *         both stacks are painted for high-water mark tracking
      * -------------------------------------------------------------*/
     
-    usp = k_alloc_p_stack(tid);             // ***you need to change this line***
+    usp = k_alloc_p_stack(tid);
     if (usp == NULL) {
         return RTX_ERR;
     }
@@ -277,9 +308,31 @@ int k_tsk_create_new(TASK_INIT *p_taskinfo, TCB *p_tcb, task_t tid)
 #endif
     }
     
+    // save control register so that we return with correct access level
+    if (p_taskinfo->priv == 1) {  // privileged 
+        control = __get_CONTROL() & ~BIT(0); 
+    } else {                      // unprivileged
+        control = __get_CONTROL() | BIT(0);
+    }
+
+#ifdef K_SHARED_STACK
+    // uR4-uR11, 8 registers, then CONTROL
+    for ( int j = 0; j < 8; j++ ) {
+#ifdef DEBUG_0
+        *(--usp) = 0xDEADCCC0 + j;
+#else
+        *(--usp) = 0x0;
+#endif
+    }
+    *(--usp) = control;
+
+    p_tcb->psp = usp;
+    p_tcb->msp = NULL;
+#else
     // allocate kernel stack for the task
     ksp = k_alloc_k_stack(tid);
     if ( ksp == NULL ) {
+        k_free_p_stack(tid);
         return RTX_ERR;
     }
 
@@ -303,15 +356,15 @@ int k_tsk_create_new(TASK_INIT *p_taskinfo, TCB *p_tcb, task_t tid)
         
     // put user sp on to the kernel stack
     *(--ksp) = (U32) usp;
-    
-    // save control register so that we return with correct access level
-    if (p_taskinfo->priv == 1) {  // privileged 
-        *(--ksp) = __get_CONTROL() & ~BIT(0); 
-    } else {                      // unprivileged
-        *(--ksp) = __get_CONTROL() | BIT(0);
-    }
+    *(--ksp) = control;
 
     p_tcb->msp = ksp;
+    p_tcb->psp = NULL;
+#endif
+
+    if (p_tcb->prio != PRIO_NULL) {
+        k_push_back_ready_queue(&readyQueues[p_tcb->prio - PRIORITY_LEVEL_TO_INDEX_OFFSET], p_tcb);
+    }
 
     return RTX_OK;
 }
@@ -355,18 +408,153 @@ K_RESTORE
 }
 
 
+#ifdef K_SHARED_STACK
+/**************************************************************************//**
+ * @brief       switch user contexts once no handler is left on the stack
+ * @details     k_tsk_run_new only pends PendSV, so the SVC that switched
+ *              returns normally and the shared kernel stack is empty when
+ *              this runs at the lowest priority. The outgoing task keeps
+ *              CONTROL and R4-R11 under its exception frame and its PSP in
+ *              the TCB, a switch costs no kernel stack at all. A task
+ *              woken by a timeout gets its ETIMEDOUT here, the last kernel
+ *              code before it runs again.
+ * @pre         gp_switch_from is NULL (task exited) or the task to save
+ *****************************************************************************/
+__asm void PendSV_Handler(void)
+{
+        PRESERVE8
+        CPSID   I                           // k_tsk_run_new from an IRQ must not see a half switch
+        LDR     R1, =__cpp(&gp_switch_from)
+        LDR     R0, [R1]
+        MOVS    R3, #0
+        STR     R3, [R1]                    // the switch request is consumed
+        LDR     R1, =__cpp(&gp_current_task)
+        LDR     R2, [R1]
+        CMP     R0, R2
+        BEQ     PendSV_Exit                 // switched back to the interrupted task
+        CBZ     R0, PendSV_Restore          // exited task, its stack is gone
+        MRS     R1, PSP
+        MRS     R3, CONTROL
+        STMDB   R1!, {R3-R11}               // save CONTROL, R4-R11 under the exception frame
+        STR     R1, [R0, #TCB_PSP_OFFSET]
+PendSV_Restore
+        LDRB    R1, [R2, #TCB_TIMEDOUT_OFFSET]
+        CBZ     R1, PendSV_Load
+        MOVS    R1, #0
+        STRB    R1, [R2, #TCB_TIMEDOUT_OFFSET]
+        LDR     R1, =__cpp(&errno)
+        MOVS    R3, #ETIMEDOUT
+        STR     R3, [R1]                    // woken by k_tsk_tick, errno is the task's now
+PendSV_Load
+        LDR     R1, [R2, #TCB_PSP_OFFSET]
+        LDMIA   R1!, {R3-R11}
+        MSR     PSP, R1                     // the exception frame of gp_current_task
+        MSR     CONTROL, R3
+        ISB
+PendSV_Exit
+        CPSIE   I
+        BX      LR                          // thread mode, PSP
+        ALIGN
+}
+
+__asm void k_tsk_start(void)
+{
+        PRESERVE8
+        LDR     R0, =__cpp(g_k_stacks)
+        ADD     R0, R0, #KERN_STACK_SIZE
+        MSR     MSP, R0                     // every SVC from now on starts at the top of the shared stack
+        LDR     R1, =__cpp(&gp_current_task)
+        LDR     R2, [R1]
+        LDR     R1, [R2, #TCB_PSP_OFFSET]
+        LDMIA   R1!, {R3-R11}
+        MSR     PSP, R1
+        MSR     CONTROL, R3
+        ISB
+        MVN     LR, #:NOT:0xFFFFFFFD        // set EXC_RETURN value, Thread mode, PSP
+        BX      LR
+        ALIGN
+}
+
+/**
+ * @brief   ask PendSV_Handler to switch from p_tcb_old to gp_current_task
+ * @note    several switches in one SVC collapse into one, only the context
+ *          of the task that was interrupted needs saving
+ */
+static void k_tsk_pend_switch(TCB *p_tcb_old)
+{
+    if ((SCB->ICSR & SCB_ICSR_PENDSVSET_Msk) == 0) {
+        gp_switch_from = (p_tcb_old->state == DORMANT) ? NULL : p_tcb_old;
+    }
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+#else
 __asm void k_tsk_start(void)
 {
         PRESERVE8
         B K_RESTORE
 }
+#endif
+
+/* MPU region attributes, see the ARMv7-M MPU_RASR register */
+#define MPU_SIZE(log2)     ((((log2) - 1) & 0x1F) << 1)
+#define MPU_AP_NONE        (0x0 << 24)     // no access, privileged or not
+#define MPU_AP_FULL        (0x3 << 24)     // read/write, privileged or not
+#define MPU_XN             BIT(28)         // execute never
+#define MPU_NORMAL         (0x1 << 19)     // TEX=001 C=0 B=0, normal non-cacheable
+#define MPU_DEVICE         BIT(16)         // TEX=000 C=0 B=1, shareable device
+
+/**************************************************************************//**
+ * @brief       program the MPU with the background map and the stack guards
+ * @details     Regions 0-2 give both privilege levels the default LPC1768 map
+ *              (code and SRAM, AHB GPIO, APB/AHB peripherals), since the
+ *              default map only applies to privileged code once the MPU is on.
+ *              MPU_RGN_U_GUARD and MPU_RGN_K_GUARD are STACK_GUARD_SIZE
+ *              no-access regions whose attributes never change. A switch
+ *              only moves their base with k_tsk_guard_set.
+ *****************************************************************************/
+void k_tsk_guard_init(void)
+{
+    MPU->CTRL = 0;
+
+    MPU->RBAR = 0x00000000 | MPU_RBAR_VALID_Msk | 0;
+    MPU->RASR = MPU_AP_FULL | MPU_NORMAL | MPU_SIZE(30) | MPU_RASR_ENABLE_Msk;
+    MPU->RBAR = 0x20090000 | MPU_RBAR_VALID_Msk | 1;
+    MPU->RASR = MPU_AP_FULL | MPU_DEVICE | MPU_XN | MPU_SIZE(16) | MPU_RASR_ENABLE_Msk;
+    MPU->RBAR = 0x40000000 | MPU_RBAR_VALID_Msk | 2;
+    MPU->RASR = MPU_AP_FULL | MPU_DEVICE | MPU_XN | MPU_SIZE(29) | MPU_RASR_ENABLE_Msk;
+
+    MPU->RBAR = (U32) g_k_stacks[TID_NULL] | MPU_RBAR_VALID_Msk | MPU_RGN_U_GUARD;
+    MPU->RASR = MPU_AP_NONE | MPU_XN | MPU_SIZE(5) | MPU_RASR_ENABLE_Msk;
+    MPU->RBAR = (U32) g_k_stacks[TID_NULL] | MPU_RBAR_VALID_Msk | MPU_RGN_K_GUARD;
+    MPU->RASR = MPU_AP_NONE | MPU_XN | MPU_SIZE(5) | MPU_RASR_ENABLE_Msk;
+
+    // a guard hit inside an SVC preempts it instead of escalating to HardFault
+    NVIC_SetPriority(SVCall_IRQn, 1);
+    NVIC_SetPriority(MemoryManagement_IRQn, 0);
+    SCB->SHCSR |= SCB_SHCSR_MEMFAULTENA_Msk;
+    MPU->CTRL = MPU_CTRL_ENABLE_Msk | MPU_CTRL_PRIVDEFENA_Msk;
+    __DSB();
+    __ISB();
+}
+
+/**
+ * @brief   move the stack guards under the stacks of the given task
+ * @note    two stores, RASR of both guard regions is left untouched
+ */
+void k_tsk_guard_set(TCB *p_tcb)
+{
+    MPU->RBAR = (U32) k_u_stack_guard(p_tcb) | MPU_RBAR_VALID_Msk | MPU_RGN_U_GUARD;
+    MPU->RBAR = (U32) K_STACK_OF(p_tcb->tid) | MPU_RBAR_VALID_Msk | MPU_RGN_K_GUARD;
+}
 
 /**************************************************************************//**
- * @brief       run a new thread. The caller becomes READY and
+ * @brief       run a new thread. A RUNNING caller becomes READY and
  *              the scheduler picks the next ready to run task.
  * @return      RTX_ERR on error and zero on success
  * @pre         gp_current_task != NULL && gp_current_task == RUNNING
  * @post        gp_current_task gets updated to next to run task
+ * @note        with K_SHARED_STACK the call returns before the switch, which
+ *              happens in PendSV_Handler once the SVC has completed
  * !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
  * @attention   CRITICAL SECTION
  * !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
@@ -390,8 +578,15 @@ int k_tsk_run_new(void)
     // at this point, gp_current_task != NULL and p_tcb_old != NULL
     if (gp_current_task != p_tcb_old) {
         gp_current_task->state = RUNNING;   // change state of the to-be-switched-in  tcb
-        p_tcb_old->state = READY;           // change state of the to-be-switched-out tcb
+        if (p_tcb_old->state == RUNNING) {
+            p_tcb_old->state = READY;       // blocked and exited tasks keep their state
+        }
+        k_tsk_guard_set(gp_current_task);   // guard the incoming stacks
+#ifdef K_SHARED_STACK
+        k_tsk_pend_switch(p_tcb_old);       // switch user contexts in PendSV_Handler
+#else
         k_tsk_switch(p_tcb_old);            // switch kernel stacks       
+#endif
     }
 
     return RTX_OK;
@@ -409,17 +604,160 @@ int k_tsk_run_new(void)
  *****************************************************************************/
 int k_tsk_yield(void)
 {
-    readyQueues[gp_current_task->prio - PRIORITY_LEVEL_TO_INDEX_OFFSET].head = gp_current_task->next;
-
-    if(readyQueues[gp_current_task->prio - PRIORITY_LEVEL_TO_INDEX_OFFSET].head != NULL){
-        gp_current_task->next->prev = NULL;
+    // the null task is not queued, it only runs while the queues are empty
+    if (gp_current_task->prio != PRIO_NULL) {
+        k_tsk_dequeue(gp_current_task);
+        k_push_back_ready_queue(&readyQueues[gp_current_task->prio - PRIORITY_LEVEL_TO_INDEX_OFFSET], gp_current_task);
     }
-
-    k_push_back_ready_queue(readyQueues[gp_current_task->prio - PRIORITY_LEVEL_TO_INDEX_OFFSET], gp_current_task);
     
     return k_tsk_run_new();
 }
 
+/**************************************************************************//**
+ * @brief       block the running task until k_tsk_unblock
+ * @return      the value k_tsk_unblock hands to the task
+ * @param       state   BLK_SEND or BLK_RECV
+ * @param       waitq   queue the task waits on, NULL if it is found otherwise.
+ *                      The queue is kept in priority order, FIFO among
+ *                      equals, so its head is the waiter to serve first.
+ * @param       ticks   RTX ticks until k_tsk_tick wakes the task with
+ *                      ETIMEDOUT, K_WAIT_FOREVER for no timeout
+ * @details     The result of a blocking call is the stacked R0 of the SVC
+ *              the task blocked in, k_tsk_unblock writes it there. With
+ *              K_SHARED_STACK this returns before the task ran again and the
+ *              SVC completes on the shared stack, so whoever wakes the task
+ *              must finish the operation on its behalf. Code after the call
+ *              must not depend on the task having been woken.
+ *****************************************************************************/
+int k_tsk_block(U8 state, tsk_ready_queue_t *waitq, U32 ticks)
+{
+    TCB *p_tcb = gp_current_task;
+
+    p_tcb->svcFrame = (U32 *) __get_PSP();
+    p_tcb->blockedAt = K_CYCLES();
+    k_tsk_dequeue(p_tcb);
+    p_tcb->state = state;
+    p_tcb->waitq = waitq;
+    if (waitq != NULL) {
+        k_tsk_wait_insert(waitq, p_tcb);
+    }
+    if (ticks != K_WAIT_FOREVER) {
+        k_tsk_timer_arm(p_tcb, ticks);
+    }
+    k_tsk_run_new();
+#ifndef K_SHARED_STACK
+    if (p_tcb->timedOut) {          // back in the task's own SVC, see k_tsk_tick
+        p_tcb->timedOut = 0;
+        errno = ETIMEDOUT;
+    }
+#endif
+    return (int) p_tcb->svcFrame[0];
+}
+
+/**
+ * @brief   make a task blocked by k_tsk_block READY again
+ * @param   ret     return value of the SVC the task blocked in
+ * @note    the caller decides whether to preempt with k_tsk_run_new
+ */
+void k_tsk_unblock(TCB *p_tcb, int ret)
+{
+    if (p_tcb->state == BLK_SEND) {
+        k_mbx_send_waited(p_tcb);   // however it ends, delivered, timed out or ENOENT
+    }
+    if (p_tcb->waitq != NULL) {
+        k_tsk_unlink(p_tcb->waitq, p_tcb);
+        p_tcb->waitq = NULL;
+    }
+    k_tsk_timer_cancel(p_tcb);
+    p_tcb->timedOut = 0;
+    p_tcb->svcFrame[0] = (U32) ret;
+    p_tcb->state = READY;
+    k_push_back_ready_queue(&readyQueues[p_tcb->prio - PRIORITY_LEVEL_TO_INDEX_OFFSET], p_tcb);
+}
+
+/**************************************************************************//**
+ * @brief   count one RTX tick off the timeouts, wake the tasks that expired
+ * @details gp_timeouts is a delta list: each TCB holds its ticks after the
+ *          one before it, so a tick only decrements the head and an expiry
+ *          is popped off the front. Arming walks the list once.
+ * @note    runs in TIMER0_IRQHandler, which can not preempt an SVC, and
+ *          switches from there like the UART handler does. errno belongs to
+ *          the running task, an expiry only sets timedOut and the task sets
+ *          ETIMEDOUT itself once it runs again.
+ *****************************************************************************/
+void k_tsk_tick(void)
+{
+    int woken = k_ev_tick();        // may take a task off gp_timeouts
+
+    woken |= k_mbx_uart_rx();       // keystrokes to the KCD task
+    TCB *p_tcb = gp_timeouts;
+
+    if (p_tcb != NULL) {
+        p_tcb->tdelta--;
+    }
+    while ((p_tcb = gp_timeouts) != NULL && p_tcb->tdelta == 0) {
+        k_tsk_unblock(p_tcb, RTX_ERR);      // also takes it off gp_timeouts
+        p_tcb->timedOut = 1;
+        woken = 1;
+    }
+    if (woken) {
+        k_tsk_run_new();    // a woken task may outrank the interrupted one
+    }
+}
+
+/**
+ * @brief   put a task on gp_timeouts to expire after ticks RTX ticks
+ * @note    a zero timeout expires on the next tick
+ */
+static void k_tsk_timer_arm(TCB *task, U32 ticks)
+{
+    TCB *prev = NULL;
+    TCB *next = gp_timeouts;
+
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    while (next != NULL && next->tdelta <= ticks) {
+        ticks -= next->tdelta;
+        prev = next;
+        next = next->tnext;
+    }
+    task->tdelta = ticks;
+    task->tprev = prev;
+    task->tnext = next;
+    if (next != NULL) {
+        next->tdelta -= ticks;
+        next->tprev = task;
+    }
+    if (prev != NULL) {
+        prev->tnext = task;
+    } else {
+        gp_timeouts = task;
+    }
+}
+
+/**
+ * @brief   take a task off gp_timeouts, nothing if it is not armed
+ */
+static void k_tsk_timer_cancel(TCB *task)
+{
+    if (task->tprev == NULL && gp_timeouts != task) {
+        return;
+    }
+    if (task->tnext != NULL) {
+        task->tnext->tdelta += task->tdelta;
+        task->tnext->tprev = task->tprev;
+    }
+    if (task->tprev != NULL) {
+        task->tprev->tnext = task->tnext;
+    } else {
+        gp_timeouts = task->tnext;
+    }
+    task->tprev = NULL;
+    task->tnext = NULL;
+    task->tdelta = 0;
+}
+
 /**
  * @brief   get task identification
  * @return  the task ID (TID) of the calling task
@@ -441,47 +779,44 @@ int k_tsk_create(task_t *task, void (*task_entry)(void), U8 prio, U32 stack_size
     printf("k_tsk_create: entering...\n\r");
     printf("task = 0x%x, task_entry = 0x%x, prio=%d, stack_size = %d\n\r", task, task_entry, prio, stack_size);
 #endif /* DEBUG_0 */
-    if(prio > LOWEST || prio < HIGH){
+    TASK_INIT taskinfo;
+    task_t tid;
+
+    if(task == NULL || task_entry == NULL){
         errno = EINVAL;
         return RTX_ERR;
     }
-    if(g_num_active_tasks >= MAX_TASKS){
-        errno = EAGAIN;
+    if(prio > LOWEST || prio < HIGH){
+        errno = EINVAL;
+        return RTX_ERR;
     }
-    // if the requested stack size is less than the minimum, set it to the minimum
-    if(stack_size < PROC_STACK_SIZE){
-        g_tcbs[g_num_active_tasks].stackSize = PROC_STACK_SIZE
-    } else {
-        g_tcbs[g_num_active_tasks].stackSize = stack_size;
+    // find a free TCB, TID_NULL is never handed out
+    for(tid = 1; tid < MAX_TASKS && g_tcbs[tid].state != DORMANT; tid++){
+        ;
     }
-
-    g_tcbs[g_num_active_tasks].pspBase = (U32) k_mpool_alloc(MPID_IRAM2, g_tcbs[g_num_active_tasks].stackSize);
-    if(g_tcbs[g_num_active_tasks].pspBase == NULL){
-        errno = ENOMEM;
+    if(tid == MAX_TASKS){
+        errno = EAGAIN;
         return RTX_ERR;
     }
 
-    g_tcbs[g_num_active_tasks].prio = prio;
-    g_tcbs[g_num_active_tasks].state = READY;
-    g_tcbs[g_num_active_tasks].tid = g_num_active_tasks;
-    g_tcbs[g_num_active_tasks].priv = UNPRIVILEGED;
-    g_tcbs[g_num_active_tasks].msp = &g_k_stacks[g_num_active_tasks][0];
-    g_tcbs[g_num_active_tasks].ptask = task_entry;
+    taskinfo.ptask        = task_entry;
+    taskinfo.u_stack_size = stack_size;
+    taskinfo.tid          = tid;
+    taskinfo.prio         = prio;
+    taskinfo.priv         = UNPRIVILEGED;
 
-    *(--g_tcbs[g_num_active_tasks].msp) = g_tcbs[g_num_active_tasks].ptask; // push PC onto stack
-    *(--g_tcbs[g_num_active_tasks].msp) = 0; // push LR with an arbitrary value
-    g_tcbs[g_num_active_tasks].msp -= 8; // Skip some of the registers
-    *(--g_tcbs[g_num_active_tasks].msp) = g_tcbs[g_num_active_tasks].pspBase; // save the PSP to R5
-    *(--g_tcbs[g_num_active_tasks].msp) = 1 << 1; // set bit[1] of the CONTROL to 1 since this is unprivileged
-
-    // add the task to the ready queue
-    k_push_back_ready_queue(&readyQueues[prio], &g_tcbs[g_num_active_tasks]);
+    // user stack comes from MPID_IRAM2, the allocator sets errno on failure
+    if(k_tsk_create_new(&taskinfo, &g_tcbs[tid], tid) != RTX_OK){
+        return RTX_ERR;
+    }
 
-    *task = g_num_active_tasks;
-    
+    *task = tid;
     g_num_active_tasks++; // increment the total number of active tasks
 
-    k_tsk_run_new();
+    if(prio < gp_current_task->prio){
+        // the new task preempts the caller
+        return k_tsk_run_new();
+    }
 
     return RTX_OK;
 }
@@ -493,8 +828,14 @@ void k_tsk_exit(void)
 #endif /* DEBUG_0 */
 
     gp_current_task->state = DORMANT;
+    k_tsk_dequeue(gp_current_task);
 
-    k_mpool_dealloc(MPID_IRAM2, gp_current_task->pspBase);
+    k_free_p_stack(gp_current_task->tid);
+    // everything the task allocated in arena mode goes back in one free
+    k_mem_arena_release(gp_current_task->tid);
+    k_hmem_release(gp_current_task->tid);
+    k_mbx_release(gp_current_task->tid);
+    k_ev_release(gp_current_task->tid);
 
     g_num_active_tasks--;
     
@@ -507,7 +848,7 @@ int k_tsk_set_prio(task_t task_id, U8 prio)
     printf("k_tsk_set_prio: entering...\n\r");
     printf("task_id = %d, prio = %d.\n\r", task_id, prio);
 #endif /* DEBUG_0 */
-    if(prio > HIGH || prio < LOWEST){
+    if(prio < HIGH || prio > LOWEST){
         errno = EINVAL;
         return RTX_ERR;
     }
@@ -527,28 +868,23 @@ int k_tsk_set_prio(task_t task_id, U8 prio)
         errno = EPERM;
         return RTX_ERR;
     }
-    // Remove the task from its old ready queue
-    if(g_tcbs[task_id].prev != NULL){
-        g_tcbs[task_id].prev->next = g_tcbs[task_id].next;
-    } else {
-        // this task is the head of the linked list
-        readyQueues[g_tcbs[task_id].prio - PRIORITY_LEVEL_TO_INDEX_OFFSET].head = g_tcbs[task_id].next;
-    }
-    if(g_tcbs[task_id].next != NULL){
-        g_tcbs[task_id].next->prev = g_tcbs[task_id].prev;
-    } else {
-        // this task is the tail of the list
-        readyQueues[g_tcbs[task_id].prio - PRIORITY_LEVEL_TO_INDEX_OFFSET].tail = g_tcbs[task_id].prev;
-    }
-    // add task to the back of its new priority level ready queue
-    k_push_back_ready_queue(readyQueues[prio - PRIORITY_LEVEL_TO_INDEX_OFFSET], g_tcbs[task_id]);
-
-    if(prio > gp_current_task->prio){
-        // schedule the adjusted task to run
-        return k_tsk_run_new();
+    if(g_tcbs[task_id].state != READY && g_tcbs[task_id].state != RUNNING){
+        // a blocked task is queued at its new priority when it wakes up,
+        // its place in a wait queue changes right away
+        g_tcbs[task_id].prio = prio;
+        if(g_tcbs[task_id].waitq != NULL){
+            k_tsk_unlink(g_tcbs[task_id].waitq, &g_tcbs[task_id]);
+            k_tsk_wait_insert(g_tcbs[task_id].waitq, &g_tcbs[task_id]);
+        }
+        return RTX_OK;
     }
+    // move the task to the back of its new priority level ready queue
+    k_tsk_dequeue(&g_tcbs[task_id]);
+    g_tcbs[task_id].prio = prio;
+    k_push_back_ready_queue(&readyQueues[prio - PRIORITY_LEVEL_TO_INDEX_OFFSET], &g_tcbs[task_id]);
 
-    return RTX_OK;    
+    // the adjusted task may now outrank the caller, or the caller may have dropped
+    return k_tsk_run_new();
 }
 
 /**
@@ -576,7 +912,7 @@ int k_tsk_get(task_t tid, RTX_TASK_INFO *buffer)
     buffer->priv          = g_tcbs[tid].priv;
     buffer->ptask         = g_tcbs[tid].ptask;
     buffer->k_sp          = __get_MSP();
-    buffer->k_sp_base     = &g_k_stacks[tid][0];
+    buffer->k_sp_base     = (U32) K_STACK_OF(tid);
     buffer->k_stack_size  = KERN_STACK_SIZE;
     buffer->state         = g_tcbs[tid].state;
     buffer->u_sp          = __get_PSP();
@@ -584,6 +920,42 @@ int k_tsk_get(task_t tid, RTX_TASK_INFO *buffer)
     return RTX_OK;     
 }
 
+/**************************************************************************//**
+ * @brief   report the deepest stack use of a task so far
+ * @return  RTX_OK on success, RTX_ERR on failure
+ * @details Both stacks are painted with STACK_PAINT when the task is created.
+ *          The scan walks up from the low end of each stack until it finds
+ *          a word that was overwritten, so its cost is the unused depth.
+ *          The MPU guard at the low end is skipped, reading it would fault
+ *          when the caller asks about its own stacks.
+ *****************************************************************************/
+int k_tsk_get_stack(task_t tid, RTX_STACK_INFO *buffer)
+{
+#ifdef DEBUG_0
+    printf("k_tsk_get_stack: tid = %d, buffer = 0x%x.\n\r", tid, buffer);
+#endif /* DEBUG_0 */
+    TCB *p_tcb;
+    U32 *guardEnd;
+
+    if (buffer == NULL) {
+        errno = EFAULT;
+        return RTX_ERR;
+    }
+    if (tid >= MAX_TASKS || g_tcbs[tid].state == DORMANT) {
+        errno = EINVAL;
+        return RTX_ERR;
+    }
+
+    p_tcb = &g_tcbs[tid];
+    buffer->k_stack_size = KERN_STACK_SIZE;
+    buffer->k_stack_used = k_stack_used(K_STACK_OF(tid) + (STACK_GUARD_SIZE >> 2),
+                                        KERN_STACK_SIZE - STACK_GUARD_SIZE);
+    buffer->u_stack_size = p_tcb->stackSize;
+    guardEnd = k_u_stack_guard(p_tcb) + (STACK_GUARD_SIZE >> 2);
+    buffer->u_stack_used = k_stack_used(guardEnd, (U32)(p_tcb->pspBase - guardEnd) << 2);
+    return RTX_OK;
+}
+
 int k_tsk_ls(task_t *buf, size_t count){
 #ifdef DEBUG_0
     printf("k_tsk_ls: buf=0x%x, count=%u\r\n", buf, count);
@@ -656,6 +1028,63 @@ static void k_push_back_ready_queue(tsk_ready_queue_t* queue, TCB *task) {
         queue->head = task;
     }
 }
+
+/**
+ * @brief   queue a task behind every waiter of the same or higher priority
+ */
+static void k_tsk_wait_insert(tsk_ready_queue_t *queue, TCB *task) {
+    TCB *next = queue->head;
+
+    while (next != NULL && next->prio <= task->prio) {
+        next = next->next;
+    }
+    if (next == NULL) {
+        k_push_back_ready_queue(queue, task);
+        return;
+    }
+    task->next = next;
+    task->prev = next->prev;
+    if (next->prev != NULL) {
+        next->prev->next = task;
+    } else {
+        queue->head = task;
+    }
+    next->prev = task;
+}
+
+/**
+ * @brief   unlink a task from the ready queue of its priority
+ */
+static void k_tsk_dequeue(TCB *task) {
+    // the null task and real-time tasks have no ready queue
+    if (task->prio < HIGH || task->prio > LOWEST) {
+        return;
+    }
+    k_tsk_unlink(&readyQueues[task->prio - PRIORITY_LEVEL_TO_INDEX_OFFSET], task);
+}
+
+/**
+ * @brief   unlink a task from a ready or wait queue
+ */
+static void k_tsk_unlink(tsk_ready_queue_t *queue, TCB *task) {
+    if (task->prev == NULL && queue->head != task) {
+        return;     // not queued, e.g. the null task
+    }
+    if (task->prev != NULL) {
+        task->prev->next = task->next;
+    } else {
+        // this task is the head of the linked list
+        queue->head = task->next;
+    }
+    if (task->next != NULL) {
+        task->next->prev = task->prev;
+    } else {
+        // this task is the tail of the list
+        queue->tail = task->prev;
+    }
+    task->prev = NULL;
+    task->next = NULL;
+}
 /*
  *===========================================================================
  *                             END OF FILE
@@ -81,6 +81,9 @@ TCB  *scheduler         (void);  /* return the TCB of the next ready to run task
 void k_tsk_switch       (TCB *); /* kernel thread context switch, two stacks */
 int  k_tsk_run_new      (void);  /* kernel runs a new thread  */
 int  k_tsk_yield        (void);  /* kernel tsk_yield function */
+int  k_tsk_block        (U8 state, tsk_ready_queue_t *waitq, U32 ticks);    /* block the running task, returns what k_tsk_unblock passes */
+void k_tsk_unblock      (TCB *p_tcb, int ret);  /* make a blocked task READY */
+void k_tsk_tick         (void);  /* expire timeouts, called from TIMER0_IRQHandler */
 void task_null          (void);  /* the null task */
 void k_tsk_init_first   (TASK_INIT *p_task);    /* init the first task */
 void k_tsk_start        (void);  /* start the first task */
@@ -93,6 +96,9 @@ int  k_tsk_set_prio     (task_t task_id, U8 prio);
 int  k_tsk_get          (task_t task_id, RTX_TASK_INFO *buffer);
 TCB  *scheduler         (void);  /* student needs to change this function */
 int  k_tsk_ls           (task_t *buf, size_t count);
+int  k_tsk_get_stack    (task_t task_id, RTX_STACK_INFO *buffer);
+void k_tsk_guard_init   (void);  /* set up the MPU and the stack guard regions */
+void k_tsk_guard_set    (TCB *p_tcb);   /* guard the stacks of the task to run */
 //int  k_rt_tsk_set       (TASK_RT *p_rt_task);
 int  k_rt_tsk_set       (TIMEVAL *p_tv);
 int  k_rt_tsk_susp      (void);
@@ -52,6 +52,8 @@ void task_null(void)
             printf("==============Task NULL: TID = %d ===============\r\n", tid);
         }
 #endif
+        // one bounded compaction step per pass, any ready task runs in between
+        hmem_compact();
         tsk_yield();
     }
 }
@@ -49,10 +49,11 @@
 
 #define RTX_IMG_END     (Image$$RW_IRAM1$$ZI$$Limit) /* linker-defined symbol*/
 #define RAM1_START_RT   (U32)(&RTX_IMG_END)             
-#define RAM1_SIZE       0x1000                       /* RAM1 size in bytres  */
-#define RAM1_SIZE_LOG2  0xC                          /* log2(RAM1_SIZE)      */
-#define RAM1_START      (IRAM1_BASE + IRAM1_SIZE - RAM1_SIZE)
+#define RAM1_ALIGN      0x100                        /* RAM1 start alignment */
+#define RAM1_START      ((RAM1_START_RT + RAM1_ALIGN - 1) & ~(RAM1_ALIGN - 1))
+                                                     /* first byte after the image */
 #define RAM1_END        (IRAM1_BASE + IRAM1_SIZE - 1)
+#define RAM1_SIZE       (RAM1_END - RAM1_START + 1)  /* RAM1 size in bytes, not a power of two */
 
 #define RAM2_START      (IRAM2_BASE)
 #define RAM2_END        (IRAM2_BASE + IRAM2_SIZE - 1)
@@ -41,13 +41,15 @@
 #include <stdint.h>	
 #include "uart_def.h"
 
+#define UART_RX_RING_SIZE   128     // keystrokes buffered between the RX ISR and the kernel, a power of two
+
 /*
  *===========================================================================
  *                             GLOBAL VARIABLES 
  *===========================================================================
  */
  
-extern uint8_t g_send_char;
+extern uint32_t g_uart_rx_drops;   // keystrokes lost to a full RX ring
 
 /*
  *===========================================================================
@@ -57,6 +59,7 @@ extern uint8_t g_send_char;
 
 
 int uart_irq_init(int n_uart);		// initialize the n_uart to use interrupt
+uint32_t uart_rx_get(uint8_t *buf, uint32_t max);  // take up to max chars from the RX ring
 
 #endif // ! UART_IRQ_H_ 
 
@@ -80,17 +80,23 @@
 #define WORST_FIT           3       /* linear worst fit search   */
 #define NEXT_FIT            4       /* linear next fit search    */
 #define BUDDY               5       /* binary buddy system       */ 
+#define BUDDY_LAZY          6       /* buddy system, deferred coalescing */
 
 #define MIN_BLK_SIZE        32      /* minimum memory block size in bytes */
 #define MIN_BLK_SIZE_LOG2   5       /* log2(MIN_BLK_SIZE) */
-#define IRAM1_MAX_BLK_SIZE  4096    /* Total size of the IRAM1 user memory block */ 
-#define IRAM1_MAX_BLK_SIZE_LOG2 12  /* log2(IRAM1_MAX_BLK_SIZE)*/
 #define IRAM2_MAX_BLK_SIZE  32768   /* TOtal size od he IRAM2 memory block */
 #define IRAM2_MAX_BLK_SIZE_LOG2 15  /* log2(IRAM2_MAX_BLK_SIZE) */ 
 #define MAX_MPOOLS          2       /* maximum number of memory pools */
 #define MPID_IRAM1          0       /* IRAM1 memory pool ID */
 #define MPID_IRAM2          1       /* IRAM2 memory pool ID */
 #define ALLOCATED_BLK_META_SIZE 8
+#define MPOOL_NUM_ORDERS    (IRAM2_MAX_BLK_SIZE_LOG2 - MIN_BLK_SIZE_LOG2 + 1)
+                                    /* number of block orders a memory pool can have */
+#define MEM_CACHE_MAX_ORDER 9       /* largest block order mem_alloc caches, 512 bytes */
+#define MEM_CACHE_ORDERS    (MEM_CACHE_MAX_ORDER - MIN_BLK_SIZE_LOG2 + 1)
+                                    /* number of block orders with magazines */
+#define MEM_CACHE_BANDS     4       /* maximum number of priority bands with their own magazines */
+#define MEM_CACHE_DEPTH     32      /* maximum high watermark of a magazine */
 
 /* Main Scheduling Algorithms */
 #define DEFAULT             0       /* preemptive priority scheduler, FCFS within each priority */
@@ -146,11 +152,26 @@
 #define DISPLAY             3       /* a message that contains chars to be displayed to the RTX console */
 #define KEY_IN              4       /* keyboard input from console */
 
+/* Message Priorities, see send_msg_prio. Lower the number is, higher the priority is. */
+#define NUM_MSG_PRIOS       4       /* priority levels of the messages in a mailbox */
+#define MSG_PRIO_URGENT     0       /* overtakes every other queued message */
+#define MSG_PRIO_HIGH       1
+#define MSG_PRIO_MEDIUM     2
+#define MSG_PRIO_NORMAL     3       /* the priority of all other send calls, FIFO */
+
+/* Event Set Sources, see ev_add */
+#define EV_SRC_NONE         0       /* free slot */
+#define EV_SRC_MBX          1       /* a message is queued in the caller's mailbox */
+#define EV_SRC_ZC           2       /* a send_msg_zc buffer is queued for the caller */
+#define EV_SRC_TIMER        3       /* a periodic timer expired */
+#define EV_SRC_FLAGS        4       /* ev_signal raised one of the flags */
+
 /* Mailbox Sizes */
 #define MSG_HDR_SIZE        sizeof(RTX_MSG_HDR)      
                                     /* rtx_msg_hdr struct size */
 #define MIN_MSG_SIZE        MSG_HDR_SIZE       
                                     /* minimum message size in bytes */
+#define MBX_LAT_BUCKETS     8       /* buckets of the MBX_STATS latency histogram */
 #define KCD_MBX_SIZE        0x200   /* KCD mailbox size */
 #define CON_MBX_SIZE        0x80    /* consolde display mailbox size */
 #define UART_MBX_SIZE       0x80    /* UART interrupt handler mailbox size */
@@ -184,6 +205,59 @@
 #define SVC_RT_TSK_SET      0x12
 #define SVC_RT_TSK_SUSP     0x13
 #define SVC_RT_TSK_GET      0x14
+#define SVC_MEM_ARENA       0x15
+#define SVC_MEM_STATS       0x16
+#define SVC_MPOOL_CREATE    0x17
+#define SVC_MPOOL_ALLOC     0x18
+#define SVC_MPOOL_DEALLOC   0x19
+#define SVC_TSK_GET_STACK   0x1A
+#define SVC_MEM_REALLOC     0x1B
+#define SVC_MEM_ALLOC_ALIGNED 0x1C
+
+/* Only in kernels built with the MEM_TRACE allocation trace */
+#ifdef MEM_TRACE
+#define SVC_MEM_TRACE_DUMP  0x1D
+#endif
+
+/* movable allocations, see hmem_alloc */
+#define SVC_HMEM_ALLOC      0x1E
+#define SVC_HMEM_FREE       0x1F
+#define SVC_HMEM_LOCK       0x23
+#define SVC_HMEM_UNLOCK     0x24
+#define SVC_HMEM_COMPACT    0x25
+
+/* zero-copy messages, see send_msg_zc */
+#define SVC_MBX_SEND_ZC     0x26
+#define SVC_MBX_RECV_ZC     0x27
+
+/* bounded blocking, see recv_msg_timeout */
+#define SVC_MBX_RECV_TIMEOUT 0x28
+#define SVC_MBX_SEND_TIMEOUT 0x29
+
+/* several messages per trap, see recv_msg_batch */
+#define SVC_MBX_RECV_BATCH  0x2A
+#define SVC_MBX_SEND_BATCH  0x2B
+
+/* publish/subscribe, see topic_publish */
+#define SVC_TOPIC_OPEN      0x2C
+#define SVC_TOPIC_SUBSCRIBE 0x2D
+#define SVC_TOPIC_UNSUBSCRIBE 0x2E
+#define SVC_TOPIC_PUBLISH   0x2F
+
+/* urgent messages, see send_msg_prio */
+#define SVC_MBX_SEND_PRIO   0x30
+
+/* event sets, see wait_any */
+#define SVC_EV_ADD          0x31
+#define SVC_EV_DEL          0x32
+#define SVC_EV_SIGNAL       0x33
+#define SVC_EV_WAIT         0x34
+
+/* selective receive, see recv_msg_type */
+#define SVC_MBX_RECV_TYPE   0x35
+
+/* mailbox instrumentation, see mbx_stats */
+#define SVC_MBX_STATS       0x36
 
 /* The following are only for P1 memory testing purpose
    P2, P3 and P4 do not provide the following sys calls to tasks */
@@ -211,6 +285,8 @@ typedef signed int          ssize_t;
 typedef unsigned char       task_t;     // task ID type
 typedef signed char         mpool_t;    // memory pool descriptor type
 typedef signed char         mbx_t;      // mailbox descriptor type
+typedef signed char         hmem_t;     // movable allocation handle type
+typedef signed char         topic_t;    // publish/subscribe topic descriptor type
 
 
 /*
@@ -226,6 +302,19 @@ typedef struct timeval {
     U32 usec;           /* microoseconds */
 } TIMEVAL; 
 
+/**
+ * @brief mem_alloc magazine configuration, indexed by [order - MIN_BLK_SIZE_LOG2]
+ * @note  An empty magazine is refilled with low blocks in one batch, and a
+ *        magazine that grows past high is drained back to low. A high
+ *        watermark of 0 leaves the order uncached.
+ */
+typedef struct mem_cache_cfg
+{
+    U8          low[MEM_CACHE_ORDERS];  /**< blocks a refill or a drain leaves in the magazine */
+    U8          high[MEM_CACHE_ORDERS]; /**< most blocks kept, at most MEM_CACHE_DEPTH         */
+    U8          bands;                  /**< magazine sets by task priority, 0 or 1 for one shared set */
+} MEM_CACHE_CFG;
+
 /**
  * @brief RTX system configuration structure
  */
@@ -233,6 +322,7 @@ typedef struct rtx_sys_info
 {
     int         mem_algo;           /**< memory allocator algorithm */
     int         sched;              /**< scheduling algorithm       */
+    const MEM_CACHE_CFG *mem_cache; /**< mem_alloc magazines, NULL for none */
 } RTX_SYS_INFO;
 
 typedef struct task_init 
@@ -264,6 +354,58 @@ typedef struct rtx_task_info
     U8          state;              /**< task state                         */
 } RTX_TASK_INFO;
 
+/**
+ * @brief Task stack usage structure
+ * @note  Used bytes are the high-water mark since the task was created
+ */
+typedef struct rtx_stack_info
+{
+    U32         k_stack_size;       /**< kernel stack size in bytes         */
+    U32         k_stack_used;       /**< deepest kernel stack use in bytes  */
+    U32         u_stack_size;       /**< user stack size in bytes           */
+    U32         u_stack_used;       /**< deepest user stack use in bytes    */
+} RTX_STACK_INFO;
+
+/**
+ * @brief Mailbox statistics structure
+ * @note  Counted since mbx_create. Times are CPU cycles. Bucket 0 of latency
+ *        counts messages received within 1024 cycles of being sent, each
+ *        further bucket covers four times the range of the one before and
+ *        the last one everything beyond.
+ */
+typedef struct mbx_stats
+{
+    U32         size;               /**< capacity in bytes                          */
+    U32         bytes_used;         /**< bytes queued, published payloads included  */
+    U32         peak_used;          /**< high-water mark of bytes_used              */
+    U32         num_msgs;           /**< messages queued                            */
+    U32         peak_msgs;          /**< high-water mark of num_msgs                */
+    U32         nb_drops;           /**< send_msg_nb and send_msg_batch refused for lack of room */
+    U32         blk_send_cycles;    /**< time senders spent blocked in BLK_SEND     */
+    U32         latency[MBX_LAT_BUCKETS];
+                                    /**< received messages by send-to-receive time  */
+} MBX_STATS;
+
+/**
+ * @brief Memory pool statistics structure
+ * @note  Block sizes and byte counts include the allocated block header
+ */
+typedef struct mpool_stats
+{
+    U32         total_size;         /**< pool size in bytes                         */
+    U32         bytes_in_use;       /**< bytes in allocated blocks                  */
+    U32         peak_in_use;        /**< high-water mark of bytes_in_use            */
+    U32         cached_bytes;       /**< bytes in mem_alloc magazines, not in use   */
+    U32         free_bytes[MPOOL_NUM_ORDERS];
+                                    /**< free bytes in blocks of 2^(i + MIN_BLK_SIZE_LOG2) bytes */
+    U32         largest_free;       /**< size of the largest free block             */
+    U32         frag_index;         /**< 0 to 1000, 1000 - 1000 * largest_free / total free bytes */
+    U32         num_allocs;         /**< successful allocations                     */
+    U32         num_frees;          /**< deallocations                              */
+    U32         num_failures;       /**< failed allocations                         */
+    U32         alloc_cycles;       /**< CPU cycles spent in successful allocations */
+} MPOOL_STATS;
+
 /* message header struct */
 typedef __packed struct rtx_msg_hdr {
     U32         length;             /**< length of the mssage buffer including the message header size */
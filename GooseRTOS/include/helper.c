@@ -12,7 +12,7 @@ static const char LogTable256[256] =
 unsigned int log_two_floor(unsigned int num){
   register unsigned int t, tt; // temporaries
   
-  if (tt = num >> 16)
+  if ((tt = num >> 16))
   {
     return (t = tt >> 8) ? 24 + LogTable256[t] : 16 + LogTable256[tt];
   }
@@ -23,20 +23,11 @@ unsigned int log_two_floor(unsigned int num){
 }
 
 unsigned int log_two_ceil(unsigned int num){
-  register unsigned int t, tt; // temporaries
-
   if (num <= 1) {
     return 0; // Handle special case for num = 0 or 1
   }
 
-  if ((num & (num - 1)) == 0) {
-    // The value is a power of 2, no rounding needed
-    return LogTable256[num];
-  }
-
-  if (tt = num >> 16) {
-    return (t = tt >> 8) ? 24 + LogTable256[t] + ((tt & 0xFF) != 0) : 16 + LogTable256[tt] + 1;
-  } else {
-    return (t = num >> 8) ? 8 + LogTable256[t] + ((num & 0xFF) != 0) : LogTable256[num] + 1;
-  }
+  // round up unless num is a power of 2, the bits below the highest one
+  // decide that, not only the low byte
+  return log_two_floor(num) + ((num & (num - 1)) != 0);
 }
\ No newline at end of file
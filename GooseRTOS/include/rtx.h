@@ -82,6 +82,40 @@ __svc(SVC_MBX_GET)      int     mbx_get(task_t tid);
 __svc(SVC_RT_TSK_SET)   int     rt_tsk_set(TIMEVAL *p_tv);
 __svc(SVC_RT_TSK_SUSP)  int     rt_tsk_susp(void);
 __svc(SVC_RT_TSK_GET)   int     rt_tsk_get(task_t task_id, TIMEVAL *buffer);
+__svc(SVC_MEM_ARENA)    int     mem_arena_create(size_t size);
+__svc(SVC_MEM_STATS)    int     mem_stats(mpool_t mpid, MPOOL_STATS *buffer);
+__svc(SVC_MPOOL_CREATE) mpool_t mpool_create(int algo, size_t size);
+__svc(SVC_MPOOL_ALLOC)  void   *mpool_alloc(mpool_t mpid, size_t size);
+__svc(SVC_MPOOL_DEALLOC) int    mpool_free(mpool_t mpid, void *ptr);
+__svc(SVC_TSK_GET_STACK) int    tsk_get_stack(task_t task_id, RTX_STACK_INFO *buffer);
+__svc(SVC_MEM_REALLOC)  void   *mem_realloc(void *ptr, size_t size);
+__svc(SVC_MEM_ALLOC_ALIGNED) void *mem_alloc_aligned(size_t size, size_t align);
+__svc(SVC_HMEM_ALLOC)   hmem_t  hmem_alloc(size_t size);
+__svc(SVC_HMEM_FREE)    int     hmem_free(hmem_t h);
+__svc(SVC_HMEM_LOCK)    void   *hmem_lock(hmem_t h);
+__svc(SVC_HMEM_UNLOCK)  int     hmem_unlock(hmem_t h);
+__svc(SVC_HMEM_COMPACT) int     hmem_compact(void);
+__svc(SVC_MBX_SEND_ZC)  int     send_msg_zc(task_t tid, void *buf);
+__svc(SVC_MBX_RECV_ZC)  int     recv_msg_zc(void **buf);
+__svc(SVC_MBX_RECV_TIMEOUT) int recv_msg_timeout(void *buf, size_t len, U32 ticks);
+__svc(SVC_MBX_SEND_TIMEOUT) int send_msg_timeout(task_t tid, const void *buf, U32 ticks);
+__svc(SVC_MBX_RECV_BATCH) int   recv_msg_batch(void *buf, size_t len, size_t max_msgs);
+__svc(SVC_MBX_SEND_BATCH) int   send_msg_batch(task_t tid, const void *buf, size_t num_msgs);
+__svc(SVC_TOPIC_OPEN)   topic_t topic_open(const char *name);
+__svc(SVC_TOPIC_SUBSCRIBE) int  topic_subscribe(topic_t topic);
+__svc(SVC_TOPIC_UNSUBSCRIBE) int topic_unsubscribe(topic_t topic);
+__svc(SVC_TOPIC_PUBLISH) int    topic_publish(topic_t topic, const void *buf);
+__svc(SVC_MBX_SEND_PRIO) int    send_msg_prio(task_t tid, const void *buf, U8 prio);
+__svc(SVC_EV_ADD)       int     ev_add(U8 kind, U32 arg);
+__svc(SVC_EV_DEL)       int     ev_del(int id);
+__svc(SVC_EV_SIGNAL)    int     ev_signal(task_t tid, U32 flags);
+__svc(SVC_EV_WAIT)      int     wait_any(U32 ticks);
+__svc(SVC_MBX_RECV_TYPE) int    recv_msg_type(void *buf, size_t len, U32 type_mask);
+__svc(SVC_MBX_STATS)    int     mbx_stats(task_t tid, MBX_STATS *buffer);
+
+#ifdef MEM_TRACE
+__svc(SVC_MEM_TRACE_DUMP) int   mem_trace_dump(void);
+#endif
 #endif // !_RTX_H_
 
 
@@ -55,6 +55,7 @@ extern  int         errno;
 #define ENOSPC      28  /* No space left on device */
 #define ENOMSG      42  /* No message of desired type */
 #define EMSGSIZE    90  /* Message too long */
+#define ETIMEDOUT   110 /* Connection timed out */
 
 
 #endif // !RTX_ERRNO_H_
@@ -0,0 +1,49 @@
+/**
+ * @file    LPC17xx.h
+ * @brief   host stand-in for the CMSIS device header, just enough for k_mem.c
+ * @note    only used by the host build in tools/memhost
+ */
+
+#ifndef MEMHOST_LPC17XX_H_
+#define MEMHOST_LPC17XX_H_
+
+#include <stdint.h>
+
+/* armcc keywords and intrinsics */
+// left empty, gcc ignores the attribute where armcc takes it and no message struct is used here
+#define __packed
+#define __svc(n)
+#define __return_address()      ((unsigned int)(uintptr_t)__builtin_return_address(0))
+#define __disable_irq()         ((void)0)
+#define __enable_irq()          ((void)0)
+#define __get_PRIMASK()         0U
+#define __set_PRIMASK(x)        ((void)(x))
+#define __DSB()                 ((void)0)
+#define __ISB()                 ((void)0)
+
+/* core peripherals, backed by plain variables in host_rt.c */
+typedef struct { volatile uint32_t CTRL, CYCCNT; } DWT_Type;
+typedef struct { volatile uint32_t DEMCR; } CoreDebug_Type;
+typedef struct { volatile uint32_t TYPE, CTRL, RNR, RBAR, RASR; } MPU_Type;
+typedef struct { volatile uint32_t CPUID, ICSR, VTOR, AIRCR, SCR, CCR, SHP[3], SHCSR, CFSR, HFSR, DFSR, MMFAR, BFAR; } SCB_Type;
+
+extern DWT_Type         host_dwt;
+extern CoreDebug_Type   host_core_debug;
+extern MPU_Type         host_mpu;
+extern SCB_Type         host_scb;
+extern uint32_t         SystemCoreClock;
+
+#define DWT             (&host_dwt)
+#define CoreDebug       (&host_core_debug)
+#define MPU             (&host_mpu)
+#define SCB             (&host_scb)
+
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk      (1UL << 0)
+#define MPU_RBAR_VALID_Msk          (1UL << 4)
+#define MPU_RASR_ENABLE_Msk         (1UL << 0)
+#define MPU_CTRL_ENABLE_Msk         (1UL << 0)
+#define MPU_CTRL_PRIVDEFENA_Msk     (1UL << 2)
+#define SCB_SHCSR_MEMFAULTENA_Msk   (1UL << 16)
+
+#endif /* !MEMHOST_LPC17XX_H_ */
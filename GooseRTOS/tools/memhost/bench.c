@@ -0,0 +1,159 @@
+/**
+ * @file    bench.c
+ * @brief   allocator throughput and latency per size class
+ * @details usage: bench [rounds] [seed]
+ *          For each size class of MPID_IRAM2, from MIN_BLK_SIZE up to a
+ *          quarter of the pool, a round allocates up to BENCH_BLOCKS blocks
+ *          and frees them in random order. Every call is timed on its own,
+ *          so the worst case includes the longest split and merge chains.
+ *          The same rounds then run with mixed sizes. Both BUDDY and
+ *          BUDDY_LAZY are measured, then mem_alloc on MPID_IRAM1 with
+ *          magazines in front of a BUDDY heap.
+ */
+
+#include "k_inc.h"
+#include "k_mem.h"
+#include "host.h"
+
+#define BENCH_BLOCKS    64
+#define BENCH_MIXED     0       // size class of the mixed workload
+
+typedef struct bench_res {
+    U32                 allocs;
+    U32                 frees;
+    U32                 failures;
+    unsigned long long  allocNs;
+    unsigned long long  freeNs;
+    U32                 allocMax;
+    U32                 freeMax;
+} bench_res_t;
+
+static void *s_ptrs[BENCH_BLOCKS];
+static int   s_cached;      // time k_mem_alloc/k_mem_dealloc instead of MPID_IRAM2
+
+// every cached order refilled and drained in batches of 8
+static const MEM_CACHE_CFG s_cache = {
+    { 8, 8, 8, 8, 8 },
+    { 16, 16, 16, 16, 16 },
+    1
+};
+
+static void *bench_alloc(U32 size)
+{
+    return s_cached ? k_mem_alloc(size) : k_mpool_alloc(MPID_IRAM2, size);
+}
+
+static int bench_free(void *ptr)
+{
+    return s_cached ? k_mem_dealloc(ptr) : k_mpool_dealloc(MPID_IRAM2, ptr);
+}
+
+/**
+ * @brief   request size of a round, a block of the given order or a random mix
+ */
+static U32 bench_size(U8 order)
+{
+    if (order == BENCH_MIXED) {
+        return 1 + host_rand() % ((1U << (MIN_BLK_SIZE_LOG2 + 6)) - ALLOCATED_BLK_META_SIZE);
+    }
+    return (1U << order) - ALLOCATED_BLK_META_SIZE;
+}
+
+static void bench_round(U8 order, bench_res_t *res)
+{
+    U32 n = 0;
+
+    while (n < BENCH_BLOCKS) {
+        U32 size = bench_size(order);
+        unsigned long long t0 = host_ns();
+        void *p = bench_alloc(size);
+        U32 dt = (U32)(host_ns() - t0);
+
+        if (p == NULL) {
+            res->failures++;
+            break;
+        }
+        s_ptrs[n++] = p;
+        res->allocs++;
+        res->allocNs += dt;
+        if (dt > res->allocMax) {
+            res->allocMax = dt;
+        }
+    }
+
+    while (n != 0) {
+        U32 i = host_rand() % n;
+        void *p = s_ptrs[i];
+        unsigned long long t0;
+        U32 dt;
+
+        s_ptrs[i] = s_ptrs[--n];
+        t0 = host_ns();
+        if (bench_free(p) != RTX_OK) {
+            printf("bench: dealloc of 0x%x failed\n", (U32)(uintptr_t)p);
+            host_exit(1);
+        }
+        dt = (U32)(host_ns() - t0);
+        res->frees++;
+        res->freeNs += dt;
+        if (dt > res->freeMax) {
+            res->freeMax = dt;
+        }
+    }
+}
+
+static void bench_report(U8 cls, bench_res_t *res)
+{
+    unsigned long long rate = res->allocNs ? res->allocs * 1000000000ULL / res->allocNs : 0;
+
+    if (cls == BENCH_MIXED) {
+        printf("  %-8s", "mixed");
+    } else {
+        printf("  %-8u", 1U << cls);
+    }
+    printf(" %10llu %8llu %8u %8llu %8u %6u\n", rate,
+           res->allocs ? res->allocNs / res->allocs : 0ULL, res->allocMax,
+           res->frees ? res->freeNs / res->frees : 0ULL, res->freeMax, res->failures);
+}
+
+int main(int argc, char **argv)
+{
+    static const int algos[] = { BUDDY, BUDDY_LAZY, BUDDY };
+    U32 rounds = host_arg(argc, argv, 1, 2000);
+    U32 seed   = host_arg(argc, argv, 2, 1);
+
+    if (host_mem_init() != 0) {
+        return 2;
+    }
+
+    for (U32 a = 0; a < sizeof(algos) / sizeof(algos[0]); a++) {
+        mpool_t mpid;
+        U8 maxOrder;
+
+        s_cached = (a == 2);
+        mpid = s_cached ? MPID_IRAM1 : MPID_IRAM2;
+        host_srand(seed);
+        host_kernel_init(algos[a], s_cached ? &s_cache : NULL);
+        maxOrder = s_cached ? MEM_CACHE_MAX_ORDER : g_mpools[MPID_IRAM2].maxOrder - 2;
+
+        printf("algo %d, %s, %u rounds of up to %u blocks\n", algos[a],
+               s_cached ? "mem_alloc with magazines" : "MPID_IRAM2", rounds, BENCH_BLOCKS);
+        printf("  %-8s %10s %8s %8s %8s %8s %6s\n",
+               "class", "allocs/s", "alloc ns", "max ns", "free ns", "max ns", "fails");
+
+        for (U8 order = MIN_BLK_SIZE_LOG2; order <= maxOrder + 1; order++) {
+            bench_res_t res = {0};
+            U8 cls = (order > maxOrder) ? BENCH_MIXED : order;
+
+            for (U32 r = 0; r < rounds; r++) {
+                bench_round(cls, &res);
+            }
+            bench_report(cls, &res);
+        }
+        if (!s_cached && g_mpools[mpid].inUse != 0) {
+            printf("bench: %u bytes still in use\n", g_mpools[mpid].inUse);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,761 @@
+/**
+ * @file    fuzz.c
+ * @brief   randomized allocator fuzzer, checks the pools after every operation
+ * @details usage: fuzz [ops] [seed]
+ *          Runs ops random operations against a BUDDY and a BUDDY_LAZY heap:
+ *          alloc, free, realloc, aligned alloc, sub-pool create/destroy,
+ *          the ISR stash path, mem_give hand-overs, mem_alloc through the
+ *          magazines of several priority bands, a mem_alloc that needs the
+ *          magazines flushed, and movable blocks with compaction steps.
+ *          After each one every active pool is walked block by block and
+ *          its free lists, quick lists and counters are checked. Live
+ *          blocks carry a fill pattern that is verified before they are
+ *          freed, so overlapping allocations are caught too.
+ */
+
+#include "k_inc.h"
+#include "k_mem.h"
+#include "helper.h"
+#include "host.h"
+
+#define MAX_LIVE    256
+#define KIND_HEAP   0       // k_mpool_alloc
+#define KIND_ALIGN  1       // k_mpool_alloc_aligned
+#define KIND_ISR    2       // k_mem_isr_alloc
+#define KIND_MEM    3       // k_mem_alloc, through the magazines
+
+typedef struct live {
+    U8     *ptr;
+    U32     size;
+    mpool_t mpid;
+    U8      seed;
+    U8      kind;
+} live_t;
+
+typedef struct hlive {
+    U32     size;           // 0 while the handle is unused
+    U8      seed;
+    U8      locks;
+    U8     *pinned;         // address returned by the first lock
+} hlive_t;
+
+static live_t   s_live[MAX_LIVE];
+static hlive_t  s_hlive[HMEM_NUM_HANDLES];
+static U32      s_num_live;
+static U32      s_op;
+static const char *s_op_name;
+static int      s_algo;
+
+// one order uncached, low 0 on another, three priority bands
+static const MEM_CACHE_CFG s_cache = {
+    { 2, 4, 0, 0, 2 },
+    { 6, 8, 3, 0, 4 },
+    3
+};
+
+static void fail(const char *what, U32 a, U32 b)
+{
+    printf("FAIL algo %d op %u (%s): %s [0x%x 0x%x]\n", s_algo, s_op, s_op_name, what, a, b);
+    host_exit(1);
+}
+
+/*
+ *===========================================================================
+ *                            POOL INVARIANTS
+ *===========================================================================
+ */
+
+/**
+ * @brief   size of the active sub-pool of parent whose region starts at addr, 0 if none
+ */
+static U32 sub_pool_at(mpool_t parent, U32 addr)
+{
+    for (mpool_t mpid = MAX_MPOOLS; mpid < NUM_MPOOLS; mpid++) {
+        memory_pool_t *pool = &g_mpools[mpid];
+
+        if (pool->active && pool->parent == parent && pool->start == addr) {
+            return pool->end - pool->start + 1;
+        }
+    }
+    return 0;
+}
+
+static void check_list(mpool_t mpid, free_memory_block_t *head, U8 order,
+                       U8 flag, U32 count, int doubly)
+{
+    memory_pool_t *pool = &g_mpools[mpid];
+    free_memory_block_t *prev = NULL;
+    U32 n = 0;
+
+    for (free_memory_block_t *blk = head; blk != NULL; blk = blk->next) {
+        U32 addr = (U32)(uintptr_t)blk;
+
+        if (++n > count) {
+            fail("list longer than its count", order, count);
+        }
+        if (addr < pool->start || addr + (1U << order) - 1 > pool->end) {
+            fail("listed block outside the pool", addr, order);
+        }
+        if (((addr - pool->start) & ((1U << order) - 1)) != 0) {
+            fail("listed block misaligned", addr, order);
+        }
+        if (blk->size != (1U << order) || blk->freeFlag != flag ||
+            (flag == MPOOL_BLK_FREE && blk->mpid != mpid)) {
+            fail("listed block header", addr, blk->size);
+        }
+        for (mpool_t sub = MAX_MPOOLS; sub < NUM_MPOOLS; sub++) {
+            memory_pool_t *child = &g_mpools[sub];
+
+            if (child->active && child->parent == mpid &&
+                addr <= child->end && addr + (1U << order) - 1 >= child->start) {
+                fail("listed block overlaps a sub-pool", addr, child->start);
+            }
+        }
+        if (doubly && blk->prev != prev) {
+            fail("broken prev link", addr, (U32)(uintptr_t)blk->prev);
+        }
+        if (flag == MPOOL_BLK_FREE && order < pool->maxOrder) {
+            // two free buddies of the same order should have been merged
+            U32 buddy = pool->start + ((addr - pool->start) ^ (1U << order));
+            free_memory_block_t *b = (free_memory_block_t *)(uintptr_t)buddy;
+
+            if (buddy + (1U << order) - 1 <= pool->end && b->mpid == mpid &&
+                b->freeFlag == MPOOL_BLK_FREE && b->size == (1U << order)) {
+                fail("free buddies not coalesced", addr, buddy);
+            }
+        }
+        prev = blk;
+    }
+    if (n != count) {
+        fail("list shorter than its count", order, count);
+    }
+}
+
+static void check_pool(mpool_t mpid)
+{
+    memory_pool_t *pool = &g_mpools[mpid];
+    U32 freeSeen[MPOOL_NUM_ORDERS] = {0};
+    U32 lazySeen[MPOOL_NUM_ORDERS] = {0};
+    U32 inUse = 0;
+    U32 cached = 0;
+    U32 addr = pool->start;
+
+    // the blocks must tile the pool exactly
+    while (addr <= pool->end) {
+        free_memory_block_t *blk = (free_memory_block_t *)(uintptr_t)addr;
+        U32 size = sub_pool_at(mpid, addr);
+        U8 flag = 0;
+
+        if (size == 0) {
+            size = blk->size;
+            flag = blk->freeFlag;
+        }
+        if (size < MIN_BLK_SIZE || (size & (size - 1)) || ((addr - pool->start) & (size - 1))) {
+            fail("bad block while walking the pool", addr, size);
+        }
+        if (addr + size - 1 > pool->end) {
+            fail("block runs past the pool end", addr, size);
+        }
+        switch (flag) {
+        case 0:
+        case MPOOL_BLK_ISR:
+            inUse += size;
+            break;
+        case MPOOL_BLK_CACHED:
+            cached += size;
+            break;
+        case MPOOL_BLK_FREE:
+            freeSeen[log_two_floor(size) - MIN_BLK_SIZE_LOG2]++;
+            break;
+        case MPOOL_BLK_LAZY:
+            lazySeen[log_two_floor(size) - MIN_BLK_SIZE_LOG2]++;
+            break;
+        default:
+            fail("bad freeFlag", addr, flag);
+        }
+        addr += size;
+    }
+    if (inUse != pool->inUse) {
+        fail("inUse does not match the allocated blocks", inUse, pool->inUse);
+    }
+    if (cached != pool->cached) {
+        fail("cached does not match the magazine blocks", cached, pool->cached);
+    }
+    if (pool->peakInUse < pool->inUse) {
+        fail("peakInUse below inUse", pool->peakInUse, pool->inUse);
+    }
+
+    for (U8 i = 0; i < MPOOL_NUM_ORDERS; i++) {
+        U8 order = i + MIN_BLK_SIZE_LOG2;
+
+        if (freeSeen[i] != pool->freeCount[i] || lazySeen[i] != pool->quickCount[i]) {
+            fail("free block count mismatch", order, freeSeen[i]);
+        }
+        if (order > pool->maxOrder && (pool->freeList[i] != NULL || pool->quickList[i] != NULL)) {
+            fail("free block above maxOrder", order, pool->maxOrder);
+        }
+        check_list(mpid, pool->freeList[i], order, MPOOL_BLK_FREE, pool->freeCount[i], 1);
+        check_list(mpid, pool->quickList[i], order, MPOOL_BLK_LAZY, pool->quickCount[i], 0);
+        if (pool->quickCount[i] > pool->lazyMax) {
+            fail("quick list past its watermark", order, pool->quickCount[i]);
+        }
+    }
+}
+
+static void check_cache(void)
+{
+    for (U8 b = 0; b < MEM_CACHE_BANDS; b++) {
+        for (U8 i = 0; i < MEM_CACHE_ORDERS; i++) {
+            mem_magazine_t *mag = &g_mem_cache[b][i];
+            U32 n = 0;
+
+            for (free_memory_block_t *blk = mag->head; blk != NULL; blk = blk->next) {
+                U32 addr = (U32)(uintptr_t)blk;
+
+                if (++n > mag->count || addr < g_mpools[MPID_IRAM1].start ||
+                    addr > g_mpools[MPID_IRAM1].end || blk->freeFlag != MPOOL_BLK_CACHED ||
+                    blk->size != (1U << (i + MIN_BLK_SIZE_LOG2))) {
+                    fail("bad magazine block", addr, b);
+                }
+            }
+            if (n != mag->count) {
+                fail("magazine count mismatch", b, i);
+            }
+            if (mag->count > g_mem_cache_cfg.high[i] || (b >= g_mem_cache_cfg.bands && mag->count)) {
+                fail("magazine past its high watermark", b, i);
+            }
+        }
+    }
+}
+
+static void verify(live_t *l, U32 size);
+
+static void check_hmem(void)
+{
+    for (hmem_t h = 0; h < HMEM_NUM_HANDLES; h++) {
+        hlive_t *hl = &s_hlive[h];
+        live_t l;
+
+        if (hl->size == 0) {
+            if (g_hmem[h].owner != TID_UNK) {
+                fail("freed handle still in use", h, g_hmem[h].owner);
+            }
+            continue;
+        }
+        if (g_hmem[h].owner == TID_UNK || g_hmem[h].locks != hl->locks) {
+            fail("handle state", h, g_hmem[h].locks);
+        }
+        if (hl->locks != 0 && g_hmem[h].ptr != hl->pinned) {
+            fail("locked block moved", h, (U32)(uintptr_t)g_hmem[h].ptr);
+        }
+        l.ptr = g_hmem[h].ptr;
+        l.size = hl->size;
+        l.seed = hl->seed;
+        verify(&l, l.size);
+    }
+}
+
+static void check_all(void)
+{
+    for (mpool_t mpid = 0; mpid < NUM_MPOOLS; mpid++) {
+        if (g_mpools[mpid].active) {
+            check_pool(mpid);
+        }
+    }
+    check_cache();
+    check_hmem();
+}
+
+/*
+ *===========================================================================
+ *                            LIVE BLOCK MODEL
+ *===========================================================================
+ */
+
+static void fill(live_t *l)
+{
+    for (U32 i = 0; i < l->size; i++) {
+        l->ptr[i] = (U8)(l->seed + i * 7);
+    }
+}
+
+static void verify(live_t *l, U32 size)
+{
+    for (U32 i = 0; i < size; i++) {
+        if (l->ptr[i] != (U8)(l->seed + i * 7)) {
+            fail("live block overwritten", (U32)(uintptr_t)l->ptr, i);
+        }
+    }
+}
+
+static void add_live(void *ptr, U32 size, mpool_t mpid, U8 kind)
+{
+    live_t *l = &s_live[s_num_live++];
+
+    l->ptr  = ptr;
+    l->size = size;
+    l->mpid = mpid;
+    l->kind = kind;
+    l->seed = (U8)host_rand();
+    fill(l);
+}
+
+static void drop_live(U32 i)
+{
+    s_live[i] = s_live[--s_num_live];
+}
+
+/**
+ * @brief   mostly small requests, a tail of large ones
+ */
+static U32 rand_size(void)
+{
+    U32 r = host_rand() % 100;
+
+    if (r < 60) {
+        return 1 + host_rand() % 120;
+    }
+    if (r < 90) {
+        return 1 + host_rand() % 1000;
+    }
+    if (r < 99) {
+        return 1 + host_rand() % 8192;
+    }
+    return 1 + host_rand() % 40000;     // often too large on purpose
+}
+
+static mpool_t rand_pool(void)
+{
+    mpool_t subs[NUM_SUB_MPOOLS];
+    U32 n = 0;
+
+    for (mpool_t mpid = MAX_MPOOLS; mpid < NUM_MPOOLS; mpid++) {
+        if (g_mpools[mpid].active) {
+            subs[n++] = mpid;
+        }
+    }
+    if (n != 0 && host_rand() % 4 == 0) {
+        return subs[host_rand() % n];
+    }
+    return host_rand() % MAX_MPOOLS;
+}
+
+/*
+ *===========================================================================
+ *                            OPERATIONS
+ *===========================================================================
+ */
+
+static void op_alloc(void)
+{
+    mpool_t mpid = rand_pool();
+    U32 size = rand_size();
+    void *p;
+
+    s_op_name = "alloc";
+    p = k_mpool_alloc(mpid, size);
+    if (p != NULL) {
+        add_live(p, size, mpid, KIND_HEAP);
+    }
+}
+
+static void op_free(void)
+{
+    U32 i = host_rand() % s_num_live;
+    live_t *l = &s_live[i];
+    int ret;
+
+    s_op_name = "free";
+    verify(l, l->size);
+    if (l->mpid >= MAX_MPOOLS && g_mpools[l->mpid].parent == MPID_IRAM1 &&
+        k_mem_isr_free(l->ptr) != RTX_ERR) {
+        fail("isr free of a sub-pool block accepted", (U32)(uintptr_t)l->ptr, l->mpid);
+    }
+    if (l->kind == KIND_ISR && host_rand() % 2) {
+        ret = k_mem_isr_free(l->ptr);
+    } else if (l->mpid == MPID_IRAM1 && l->kind != KIND_ALIGN && host_rand() % 2) {
+        ret = k_mem_dealloc(l->ptr);
+    } else {
+        ret = k_mpool_dealloc(l->mpid, l->ptr);
+    }
+    if (ret != RTX_OK) {
+        fail("dealloc of a live block failed", (U32)(uintptr_t)l->ptr, errno);
+    }
+    drop_live(i);
+}
+
+static void op_double_free(void)
+{
+    U32 i = host_rand() % s_num_live;
+    live_t *l = &s_live[i];
+
+    s_op_name = "double free";
+    verify(l, l->size);
+    if (l->kind == KIND_ISR) {
+        if (k_mem_isr_free(l->ptr) != RTX_OK) {
+            fail("isr free of a live block failed", (U32)(uintptr_t)l->ptr, 0);
+        }
+        if (k_mem_isr_free(l->ptr) != RTX_ERR || k_mem_dealloc(l->ptr) != RTX_ERR) {
+            fail("double isr free not detected", (U32)(uintptr_t)l->ptr, 0);
+        }
+        drop_live(i);
+        return;
+    }
+    if (l->kind == KIND_MEM) {
+        if (k_mem_dealloc(l->ptr) != RTX_OK) {
+            fail("dealloc of a live block failed", (U32)(uintptr_t)l->ptr, errno);
+        }
+        if (k_mem_dealloc(l->ptr) != RTX_ERR) {
+            fail("double free not detected", (U32)(uintptr_t)l->ptr, 0);
+        }
+        drop_live(i);
+        return;
+    }
+    if (k_mpool_dealloc(l->mpid, l->ptr) != RTX_OK) {
+        fail("dealloc of a live block failed", (U32)(uintptr_t)l->ptr, errno);
+    }
+    if (k_mpool_dealloc(l->mpid, l->ptr) != RTX_ERR) {
+        fail("double free not detected", (U32)(uintptr_t)l->ptr, 0);
+    }
+    drop_live(i);
+}
+
+/**
+ * @brief   give a block to tid 2, the old owner may then neither free nor
+ *          resize it, and tid 2 gives it back
+ */
+static void op_give(void)
+{
+    U32 i = host_rand() % s_num_live;
+    live_t *l = &s_live[i];
+    TCB *self = gp_current_task;
+
+    s_op_name = "give";
+    if (l->mpid != MPID_IRAM1 || l->kind == KIND_ISR) {
+        return;
+    }
+    verify(l, l->size);
+    if (k_mem_give(l->ptr, 2) != RTX_OK) {
+        fail("give of a live block failed", (U32)(uintptr_t)l->ptr, errno);
+    }
+    errno = 0;
+    if (k_mem_dealloc(l->ptr) != RTX_ERR || errno != EPERM) {
+        fail("dealloc by the old owner accepted", (U32)(uintptr_t)l->ptr, errno);
+    }
+    errno = 0;
+    if (k_mem_realloc(l->ptr, l->size + 1) != NULL || errno != EPERM) {
+        fail("realloc by the old owner accepted", (U32)(uintptr_t)l->ptr, errno);
+    }
+    verify(l, l->size);
+
+    gp_current_task = &g_tcbs[2];
+    if (k_mem_give(l->ptr, self->tid) != RTX_OK) {
+        fail("give back by the new owner failed", (U32)(uintptr_t)l->ptr, errno);
+    }
+    gp_current_task = self;
+}
+
+static void op_realloc(void)
+{
+    U32 i = host_rand() % s_num_live;
+    live_t *l = &s_live[i];
+    U32 size = rand_size();
+    U32 keep = (size < l->size) ? size : l->size;
+    U8 *p;
+
+    s_op_name = "realloc";
+    if (l->kind == KIND_ISR) {
+        return;                     // the stash sizes are fixed
+    }
+    verify(l, l->size);
+    p = k_mpool_realloc(l->mpid, l->ptr, size);
+    if (p == NULL) {
+        verify(l, l->size);         // a failed realloc leaves the block alone
+        return;
+    }
+    l->ptr = p;
+    verify(l, keep);
+    l->size = size;
+    l->kind = KIND_HEAP;
+    fill(l);
+}
+
+static void op_aligned(void)
+{
+    mpool_t mpid = rand_pool();
+    U32 align = 1U << (host_rand() % 11);
+    U32 size = 1 + host_rand() % 600;
+    void *p;
+
+    s_op_name = "aligned alloc";
+    errno = 0;
+    p = k_mpool_alloc_aligned(mpid, size, align);
+    if (p == NULL) {
+        if (errno == EINVAL) {
+            fail("power of two alignment refused", align, g_mpools[mpid].start);
+        }
+        return;
+    }
+    if ((U32)(uintptr_t)p & (align - 1)) {
+        fail("misaligned result", (U32)(uintptr_t)p, align);
+    }
+    add_live(p, size, mpid, KIND_ALIGN);
+}
+
+static void op_sub_pool(void)
+{
+    mpool_t victim = RTX_ERR;
+
+    for (mpool_t mpid = MAX_MPOOLS; mpid < NUM_MPOOLS; mpid++) {
+        if (g_mpools[mpid].active) {
+            victim = mpid;
+        }
+    }
+    if (victim != RTX_ERR && host_rand() % 2) {
+        s_op_name = "sub-pool destroy";
+        for (U32 i = 0; i < s_num_live; ) {
+            if (s_live[i].mpid == victim) {
+                verify(&s_live[i], s_live[i].size);
+                drop_live(i);
+            } else {
+                i++;
+            }
+        }
+        if (k_mpool_destroy(victim) != RTX_OK) {
+            fail("destroy failed", victim, errno);
+        }
+    } else {
+        s_op_name = "sub-pool create";
+        k_mpool_create_sub(host_rand() % MAX_MPOOLS, s_algo, 256U << (host_rand() % 6));
+    }
+}
+
+static void op_mem_alloc(void)
+{
+    static const U8 prios[] = { PRIO_RT, HIGH, MEDIUM, LOW, LOWEST };
+    U32 size = 1 + host_rand() % 600;
+    void *p;
+
+    s_op_name = "mem alloc";
+    gp_current_task->prio = prios[host_rand() % sizeof(prios)];
+    p = k_mem_alloc(size);
+    if (p != NULL) {
+        add_live(p, size, MPID_IRAM1, KIND_MEM);
+    }
+}
+
+/**
+ * @brief   order of the largest free block of MPID_IRAM1, 0 if none
+ */
+static U8 largest_free(void)
+{
+    for (U8 i = MPOOL_NUM_ORDERS; i > 0; i--) {
+        if (g_mpools[MPID_IRAM1].freeList[i - 1] != NULL) {
+            return i - 1 + MIN_BLK_SIZE_LOG2;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief   fill the magazines, then ask mem_alloc for more than the free lists hold
+ * @details The request can only be served out of the blocks parked in the
+ *          magazines, which must all be handed back before it fails.
+ */
+static void op_mem_squeeze(void)
+{
+    void *p[MEM_CACHE_DEPTH];
+    U8 order;
+
+    s_op_name = "mem squeeze";
+    gp_current_task->prio = MEDIUM;
+    for (U8 i = 0; i < MEM_CACHE_ORDERS; i++) {
+        U32 n = 0;
+
+        while (n < s_cache.high[i] &&
+               (p[n] = k_mem_alloc((1U << (i + MIN_BLK_SIZE_LOG2)) - ALLOCATED_BLK_META_SIZE)) != NULL) {
+            n++;
+        }
+        while (n > 0) {
+            k_mem_dealloc(p[--n]);
+        }
+    }
+
+    order = (largest_free() == 0) ? MIN_BLK_SIZE_LOG2 : largest_free() + 1;
+    if (order > g_mpools[MPID_IRAM1].maxOrder) {
+        return;
+    }
+    p[0] = k_mem_alloc((1U << order) - ALLOCATED_BLK_META_SIZE);
+    if (p[0] != NULL) {
+        add_live(p[0], (1U << order) - ALLOCATED_BLK_META_SIZE, MPID_IRAM1, KIND_MEM);
+        return;
+    }
+    for (U8 b = 0; b < MEM_CACHE_BANDS; b++) {
+        for (U8 i = 0; i < MEM_CACHE_ORDERS; i++) {
+            if (g_mem_cache[b][i].count != 0) {
+                fail("mem_alloc failed with blocks left in a magazine", b, i);
+            }
+        }
+    }
+}
+
+static void op_hmem(void)
+{
+    hmem_t h = host_rand() % HMEM_NUM_HANDLES;
+    hlive_t *hl = &s_hlive[h];
+    U32 r = host_rand() % 100;
+
+    if (r < 40) {
+        s_op_name = "hmem compact";
+        for (U32 n = host_rand() % 4; n > 0; n--) {
+            U8 before = largest_free();
+
+            if (k_hmem_compact() == 0) {
+                break;
+            }
+            if (largest_free() < before) {
+                fail("compaction shrank the largest free block", before, largest_free());
+            }
+        }
+    } else if (hl->size == 0) {
+        live_t l;
+
+        s_op_name = "hmem alloc";
+        l.size = 1 + host_rand() % 600;
+        h = k_hmem_alloc(l.size);
+        if (h == RTX_ERR) {
+            return;
+        }
+        if (s_hlive[h].size != 0) {
+            fail("handle handed out twice", h, 0);
+        }
+        l.ptr = g_hmem[h].ptr;
+        l.seed = (U8)host_rand();
+        fill(&l);
+        s_hlive[h].size = l.size;
+        s_hlive[h].seed = l.seed;
+        s_hlive[h].locks = 0;
+    } else if (r < 60 && hl->locks == 0) {
+        s_op_name = "hmem free";
+        if (k_hmem_free(h) != RTX_OK || k_hmem_free(h) != RTX_ERR) {
+            fail("hmem free", h, errno);
+        }
+        hl->size = 0;
+    } else if (r < 80 || hl->locks == 0) {
+        U8 *p;
+
+        s_op_name = "hmem lock";
+        p = k_hmem_lock(h);
+        if (p == NULL || (hl->locks != 0 && p != hl->pinned)) {
+            fail("hmem lock", h, (U32)(uintptr_t)p);
+        }
+        hl->pinned = p;
+        hl->locks++;
+        if (k_mem_dealloc(p) != RTX_ERR || k_mem_realloc(p, 8) != NULL) {
+            fail("raw free of a movable block accepted", h, (U32)(uintptr_t)p);
+        }
+    } else {
+        s_op_name = "hmem unlock";
+        if (k_hmem_unlock(h) != RTX_OK) {
+            fail("hmem unlock", h, errno);
+        }
+        hl->locks--;
+    }
+}
+
+static void op_isr(void)
+{
+    U32 size = 1 + host_rand() % 250;
+    void *p;
+
+    s_op_name = "isr alloc";
+    p = k_mem_isr_alloc(size);
+    if (p != NULL) {
+        add_live(p, size, MPID_IRAM1, KIND_ISR);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const int algos[] = { BUDDY, BUDDY_LAZY };
+    U32 ops  = host_arg(argc, argv, 1, 100000);
+    U32 seed = host_arg(argc, argv, 2, 1);
+
+    if (host_mem_init() != 0) {
+        return 2;
+    }
+
+    for (U32 a = 0; a < sizeof(algos) / sizeof(algos[0]); a++) {
+        U32 fails = 0;
+
+        s_algo = algos[a];
+        s_num_live = 0;
+        for (hmem_t h = 0; h < HMEM_NUM_HANDLES; h++) {
+            s_hlive[h].size = 0;
+        }
+        host_srand(seed);
+        host_kernel_init(s_algo, &s_cache);
+        s_op_name = "k_mem_init";
+        check_all();
+
+        for (s_op = 0; s_op < ops; s_op++) {
+            U32 r = host_rand() % 100;
+            U32 before = g_mpools[MPID_IRAM1].numFailures + g_mpools[MPID_IRAM2].numFailures;
+
+            if (s_num_live == 0 || (r < 25 && s_num_live < MAX_LIVE)) {
+                op_alloc();
+            } else if (r < 38 && s_num_live < MAX_LIVE) {
+                op_mem_alloc();
+            } else if (r < 40 && s_num_live < MAX_LIVE) {
+                op_mem_squeeze();
+            } else if (r < 72) {
+                op_free();
+            } else if (r < 74) {
+                op_double_free();
+            } else if (r < 76) {
+                op_give();
+            } else if (r < 85) {
+                op_realloc();
+            } else if (r < 88) {
+                if (s_num_live < MAX_LIVE) {
+                    op_aligned();
+                }
+            } else if (r < 92) {
+                op_hmem();
+            } else if (r < 95) {
+                op_sub_pool();
+            } else if (s_num_live < MAX_LIVE) {
+                op_isr();
+            }
+            fails += g_mpools[MPID_IRAM1].numFailures + g_mpools[MPID_IRAM2].numFailures - before;
+
+            if (g_isr_refill) {
+                s_op_name = "isr refill";
+                k_mem_isr_refill();     // what SVC_Handler does on its way out
+            }
+            check_all();
+        }
+
+        // everything goes back, the system pools must then be whole again
+        s_op_name = "drain";
+        while (s_num_live != 0) {
+            op_free();
+        }
+        for (hmem_t h = 0; h < HMEM_NUM_HANDLES; h++) {
+            if (s_hlive[h].size != 0 && k_hmem_free(h) != RTX_OK) {
+                fail("hmem free", h, errno);
+            }
+            s_hlive[h].size = 0;
+        }
+        for (mpool_t mpid = MAX_MPOOLS; mpid < NUM_MPOOLS; mpid++) {
+            if (g_mpools[mpid].active) {
+                k_mpool_destroy(mpid);
+            }
+        }
+        check_all();
+
+        printf("algo %d: %u ops, seed %u, %u failed allocations, OK\n",
+               s_algo, ops, seed, fails);
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+/**
+ * @file    host.h
+ * @brief   host runtime for the tools/memhost build of k_mem.c
+ * @note    safe to include next to the kernel headers, it pulls in no libc
+ *          header (common.h has its own size_t)
+ */
+
+#ifndef MEMHOST_HOST_H_
+#define MEMHOST_HOST_H_
+
+int                 host_mem_init   (void);     /* map IRAM1 and IRAM2 at their LPC1768 addresses */
+unsigned long long  host_ns         (void);     /* monotonic time in ns */
+void                host_exit       (int code);
+unsigned int        host_rand       (void);     /* xorshift32, seeded by host_srand */
+void                host_srand      (unsigned int seed);
+unsigned int        host_arg        (int argc, char **argv, int i, unsigned int dflt);
+
+struct mem_cache_cfg;
+void                host_kernel_init(int algo, const struct mem_cache_cfg *cache);
+                                                /* k_mem_init with a running task, see host_kernel.c */
+
+#endif /* !MEMHOST_HOST_H_ */
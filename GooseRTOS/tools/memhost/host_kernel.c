@@ -0,0 +1,33 @@
+/**
+ * @file    host_kernel.c
+ * @brief   kernel globals k_mem.c expects from k_task.c and k_rtx_init.c
+ */
+
+#include "k_inc.h"
+#include "k_mem.h"
+#include "host.h"
+
+int  errno = 0;
+TCB *gp_current_task = NULL;
+TCB  g_tcbs[MAX_TASKS];
+
+/**
+ * @brief   reset both system pools and pretend tid 1 is running at MEDIUM
+ */
+void host_kernel_init(int algo, const MEM_CACHE_CFG *cache)
+{
+    gp_current_task = NULL;
+    for (task_t tid = 0; tid < MAX_TASKS; tid++) {
+        g_tcbs[tid].tid = tid;
+        g_tcbs[tid].state = DORMANT;
+        g_tcbs[tid].heap = MPID_IRAM1;
+        g_tcbs[tid].pspBase = NULL;
+    }
+    if (k_mem_init(algo, cache) != RTX_OK) {
+        printf("memhost: k_mem_init(%d) failed, errno = %d\n", algo, errno);
+        host_exit(2);
+    }
+    g_tcbs[1].state = RUNNING;
+    g_tcbs[1].prio = MEDIUM;
+    gp_current_task = &g_tcbs[1];
+}
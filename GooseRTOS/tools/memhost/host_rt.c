@@ -0,0 +1,97 @@
+/**
+ * @file    host_rt.c
+ * @brief   libc side of the host runtime: memory map, time, console
+ * @note    kept apart from the kernel headers, whose size_t clashes with libc
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "LPC17xx.h"
+
+#define IRAM1_BASE  0x10000000UL
+#define IRAM2_BASE  0x2007C000UL
+#define IRAM_SIZE   0x8000UL
+
+DWT_Type        host_dwt;
+CoreDebug_Type  host_core_debug;
+MPU_Type        host_mpu;
+SCB_Type        host_scb;
+uint32_t        SystemCoreClock = 100000000;
+
+static unsigned int s_rand = 2463534242U;
+
+/* the kernel keeps addresses in U32, so the RAM has to sit where it does on the board,
+   populated up front so page faults do not show up in the latencies */
+static int host_map(unsigned long base, unsigned long size)
+{
+    void *p = mmap((void *)base, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_POPULATE, -1, 0);
+
+    if (p != (void *)base) {
+        fprintf(stderr, "memhost: cannot map 0x%lx bytes at 0x%lx\n", size, base);
+        return -1;
+    }
+    return 0;
+}
+
+int host_mem_init(void)
+{
+    if (host_map(IRAM1_BASE, IRAM_SIZE) || host_map(IRAM2_BASE, IRAM_SIZE)) {
+        return -1;
+    }
+    return 0;
+}
+
+unsigned long long host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void host_exit(int code)
+{
+    fflush(stdout);
+    exit(code);
+}
+
+void host_srand(unsigned int seed)
+{
+    s_rand = seed ? seed : 2463534242U;
+}
+
+unsigned int host_rand(void)
+{
+    s_rand ^= s_rand << 13;
+    s_rand ^= s_rand >> 17;
+    s_rand ^= s_rand << 5;
+    return s_rand;
+}
+
+unsigned int host_arg(int argc, char **argv, int i, unsigned int dflt)
+{
+    return (i < argc) ? (unsigned int)strtoul(argv[i], NULL, 0) : dflt;
+}
+
+/* console of the kernel printf and the MEM_TRACE dump */
+void tfp_printf(char *fmt, ...)
+{
+    va_list va;
+
+    va_start(va, fmt);
+    vprintf(fmt, va);
+    va_end(va);
+}
+
+int uart_put_char(int n_uart, char c)
+{
+    (void)n_uart;
+    return putchar((unsigned char)c);
+}
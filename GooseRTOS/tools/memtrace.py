@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+"""Decode the allocation trace dumped by mem_trace_dump() over UART1.
+
+Build the kernel with the MEM_TRACE define, call mem_trace_dump() from a
+task, and capture the UART1 output to a file (or read it straight from the
+serial port with --port, which needs pyserial). Then run
+
+    memtrace.py capture.bin --axf RTX-App/Objects/rtx-app.axf
+
+The report lists
+  - leak candidates: blocks still allocated at the end of the trace,
+    grouped by allocation site,
+  - hot allocation sites: call sites by number of allocations and bytes,
+  - a fragmentation timeline of MPID_IRAM1 and MPID_IRAM2: bytes in use,
+    largest free buddy block and fragmentation index over time. Blocks
+    parked in the mem_alloc magazines count as in use, as they do for the
+    buddy core.
+
+The record layout mirrors mem_trace_rec_t in RTX-App/src/kernel/k_inc.h.
+"""
+
+import argparse
+import bisect
+import collections
+import struct
+import sys
+
+MAGIC = 0x4352544D                  # "MTRC"
+HDR = struct.Struct("<IHHIII")      # magic, version, rec size, count, total, hz
+POOLS = struct.Struct("<IIII")      # IRAM1 start/end, IRAM2 start/end
+REC = struct.Struct("<IIIIIBBBB")   # cycles, site, kSite, addr, size, event, mpid, tid, order
+
+(EV_ALLOC, EV_FREE, EV_FAIL, EV_RESIZE, EV_POOL_CREATE, EV_POOL_DESTROY,
+ EV_CACHE_FILL, EV_CACHE_DRAIN) = range(1, 9)
+EV_CACHED = 0x80                    # alloc/free served by a magazine, the pool is not touched
+MIN_BLK_SIZE = 32
+POOL_NAMES = ("IRAM1", "IRAM2")
+
+
+class Symbols:
+    """Function symbols of an ELF32 little-endian image such as the Keil .axf."""
+
+    def __init__(self, path=None):
+        self.addrs, self.syms = [], []
+        if path:
+            self._load(path)
+
+    def _load(self, path):
+        data = open(path, "rb").read()
+        if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+            sys.exit("%s: not a little-endian ELF32 image" % path)
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", data, 0x2E)
+        sections = [struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize)
+                    for i in range(shnum)]
+        funcs = []
+        for sh in sections:
+            if sh[1] != 2:                          # SHT_SYMTAB
+                continue
+            strtab = sections[sh[6]]
+            for off in range(sh[4], sh[4] + sh[5], 16):
+                name, value, size, info, _, _ = struct.unpack_from("<IIIBBH", data, off)
+                if info & 0x0F != 2:                # STT_FUNC
+                    continue
+                start = strtab[4] + name
+                funcs.append((value & ~1, size, data[start:data.index(b"\0", start)].decode()))
+        funcs.sort()
+        self.addrs = [f[0] for f in funcs]
+        self.syms = funcs
+
+    def __call__(self, addr):
+        i = bisect.bisect_right(self.addrs, addr & ~1) - 1
+        if i >= 0:
+            base, size, name = self.syms[i]
+            if size == 0 or addr - base < size:
+                return "%s+0x%x" % (name, addr - base)
+        return "0x%08x" % addr
+
+
+def read_capture(args):
+    if args.port:
+        import serial                               # pyserial
+        port = serial.Serial(args.port, args.baud, timeout=args.timeout)
+        data = port.read(1 << 20)
+    elif args.capture == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        data = open(args.capture, "rb").read()
+    # the dump may be surrounded by printf output, use the last one
+    at = data.rfind(struct.pack("<I", MAGIC))
+    if at < 0:
+        sys.exit("no trace dump found in the capture")
+    return data[at:]
+
+
+def parse(data):
+    magic, version, recsize, count, total, hz = HDR.unpack_from(data, 0)
+    if version not in (1, 2) or recsize != REC.size:
+        sys.exit("unsupported dump version %d, record size %d" % (version, recsize))
+    pools = POOLS.unpack_from(data, HDR.size)
+    base = HDR.size + POOLS.size
+    if len(data) < base + count * REC.size:
+        sys.exit("truncated dump: %d of %d records" % ((len(data) - base) // REC.size, count))
+    recs = [REC.unpack_from(data, base + i * REC.size) for i in range(count)]
+    # CYCCNT wraps every 2^32 cycles, assume no gap between events is longer
+    wraps, last, out = 0, None, []
+    for r in recs:
+        if last is not None and r[0] < last:
+            wraps += 1
+        last = r[0]
+        out.append(((wraps << 32) + r[0],) + r[1:])
+    return total, hz, ((pools[0], pools[1]), (pools[2], pools[3])), out
+
+
+class BuddyMap:
+    """Occupancy of one system pool, one flag per MIN_BLK_SIZE granule."""
+
+    def __init__(self, start, end):
+        self.start, self.size = start, end - start + 1
+        self.used = bytearray(self.size // MIN_BLK_SIZE)
+
+    def owns(self, addr):
+        return self.start <= addr < self.start + self.size
+
+    def mark(self, addr, order, used):
+        first = (addr - self.start) // MIN_BLK_SIZE
+        for i in range(first, first + (1 << order) // MIN_BLK_SIZE):
+            self.used[i] = used
+
+    def largest_free(self):
+        # roots are laid out largest first, so an aligned free run is a free buddy block
+        order = self.size.bit_length() - 1
+        while (1 << order) >= MIN_BLK_SIZE:
+            n = (1 << order) // MIN_BLK_SIZE
+            for i in range(0, len(self.used) - n + 1, n):
+                if not any(self.used[i:i + n]):
+                    return 1 << order
+            order -= 1
+        return 0
+
+    def in_use(self):
+        return sum(self.used) * MIN_BLK_SIZE
+
+
+def report(args, total, hz, pools, recs, sym):
+    lost = total - len(recs)
+    print("%d events recorded, %d in this dump%s" %
+          (total, len(recs), ", the oldest %d were overwritten" % lost if lost else ""))
+    if not recs:
+        return
+
+    live = {}                                       # block -> record that allocated it
+    sites = collections.defaultdict(lambda: [0, 0, 0])  # allocs, bytes, failures
+    maps = [BuddyMap(*p) for p in pools]
+    step = max(1, len(recs) // args.steps)
+    t0 = recs[0][0]
+
+    print("\nfragmentation timeline (ms, pool, in use, largest free, frag index)")
+    for n, (t, site, ksite, addr, size, ev, mpid, tid, order) in enumerate(recs):
+        key = site or ksite
+        pool = next((m for m in maps if m.owns(addr)), None)
+        cached, ev = ev & EV_CACHED, ev & ~EV_CACHED
+        if ev == EV_ALLOC:
+            live[(mpid, addr)] = (site, ksite, size, order, tid)
+            sites[key][0] += 1
+            sites[key][1] += size
+        elif ev == EV_FREE:
+            live.pop((mpid, addr), None)
+        elif ev == EV_FAIL:
+            sites[key][2] += 1
+        elif ev == EV_RESIZE and (mpid, addr) in live:
+            if pool and mpid < len(maps):
+                pool.mark(addr, live[(mpid, addr)][3], 0)
+            live[(mpid, addr)] = (site, ksite, size, order, tid)
+        elif ev == EV_POOL_DESTROY:
+            # the whole region went back in one free, so did everything in it
+            live = {k: v for k, v in live.items() if k[0] != mpid}
+
+        # blocks of sub-pools sit inside a region already marked in its parent,
+        # magazine blocks stay marked from their fill until their drain
+        if pool and not cached and (mpid < len(maps) or ev in (EV_POOL_CREATE, EV_POOL_DESTROY)):
+            if ev in (EV_ALLOC, EV_RESIZE, EV_POOL_CREATE, EV_CACHE_FILL):
+                pool.mark(addr, order, 1)
+            elif ev in (EV_FREE, EV_POOL_DESTROY, EV_CACHE_DRAIN):
+                pool.mark(addr, order, 0)
+
+        if n % step == 0 or ev == EV_FAIL or n == len(recs) - 1:
+            ms = (t - t0) * 1000.0 / hz
+            for name, m in zip(POOL_NAMES, maps):
+                used, largest = m.in_use(), m.largest_free()
+                free = m.size - used
+                frag = 0 if free == 0 else 1000 - largest * 1000 // free
+                mark = "  <- allocation failed" if ev == EV_FAIL and mpid == POOL_NAMES.index(name) else ""
+                print("%10.3f  %s  %6d  %6d  %4d%s" % (ms, name, used, largest, frag, mark))
+
+    if lost:
+        print("\nnote: blocks allocated before the oldest record are not tracked")
+
+    print("\nleak candidates (still allocated at the end of the trace)")
+    leaks = collections.defaultdict(list)
+    for (mpid, addr), (site, ksite, size, order, tid) in live.items():
+        leaks[(site, ksite)].append((size, tid, mpid))
+    for (site, ksite), blocks in sorted(leaks.items(), key=lambda kv: -sum(b[0] for b in kv[1])):
+        tids = sorted(set(b[1] for b in blocks))
+        print("  %6d B in %3d block(s)  %-32s via %-28s tid %s" %
+              (sum(b[0] for b in blocks), len(blocks), sym(site), sym(ksite),
+               ",".join(map(str, tids))))
+
+    print("\nhot allocation sites")
+    ranked = sorted(sites.items(), key=lambda kv: (-kv[1][0], -kv[1][1]))
+    for key, (count, nbytes, fails) in ranked[:args.top]:
+        print("  %6d allocs %8d B %4d failed  %s" % (count, nbytes, fails, sym(key)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("capture", nargs="?", default="-", help="raw UART1 capture, - for stdin")
+    ap.add_argument("--axf", help="kernel image to symbolize call sites against")
+    ap.add_argument("--port", help="read the dump from this serial port instead")
+    ap.add_argument("--baud", type=int, default=115200)
+    ap.add_argument("--timeout", type=float, default=5.0, help="serial read timeout in s")
+    ap.add_argument("--steps", type=int, default=20, help="timeline rows per pool")
+    ap.add_argument("--top", type=int, default=15, help="hot sites to list")
+    args = ap.parse_args()
+
+    total, hz, pools, recs = parse(read_capture(args))
+    report(args, total, hz, pools, recs, Symbols(args.axf))
+
+
+if __name__ == "__main__":
+    main()